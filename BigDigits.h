@@ -0,0 +1,166 @@
+#pragma once
+#include <TFT_eSPI.h>
+// big numbers for the weight
+// the characters are unpacked from a font into a small 1 bit atlas once, then each one is
+// scaled up into a cell buffer and pushed in a single window, only the cells that changed are sent
+class CBigDigits {
+public:
+    // the characters in the atlas, anything else is drawn as a blank
+#define BIG_DIGITS_CHARS "0123456789.gm"
+    static const int AtlasCount = sizeof(BIG_DIGITS_CHARS) - 1;
+#define BIG_DIGITS_MAX_CELLS 10
+private:
+    TFT_eSPI* m_pTft = NULL;
+    int m_nScale = 1;
+    uint16_t m_fgColor = TFT_WHITE;
+    uint16_t m_bgColor = TFT_BLACK;
+    int m_nHeight = 0;                  // cell height in font pixels, ascent plus descent of the atlas characters
+    int m_nBaseline = 0;                // from the top of the cell
+    int m_nBlankWidth = 0;              // width for characters that aren't in the atlas
+    // the atlas, one row is (width+7)/8 bytes
+    uint8_t m_nWidth[AtlasCount];       // cell width in font pixels, the xAdvance
+    uint16_t m_nOffset[AtlasCount];     // where each character starts in m_pAtlas
+    uint8_t* m_pAtlas = NULL;
+    uint16_t* m_pCellBuffer = NULL;     // one scaled cell in display colors
+    // what is on the display now
+    char m_lastText[BIG_DIGITS_MAX_CELLS + 1];
+    int m_lastX[BIG_DIGITS_MAX_CELLS];
+    int m_nLastLeft = 0, m_nLastRight = 0;
+    bool m_bValid = false;
+
+    static int AtlasIndex(char ch)
+    {
+        for (int ix = 0; ix < AtlasCount; ++ix) {
+            if (BIG_DIGITS_CHARS[ix] == ch)
+                return ix;
+        }
+        return -1;
+    }
+    int CellWidth(char ch)
+    {
+        int ix = AtlasIndex(ch);
+        return ix == -1 ? m_nBlankWidth : m_nWidth[ix];
+    }
+    // scale one character into the cell buffer and send it
+    void DrawCell(int x, int y, char ch)
+    {
+        int ix = AtlasIndex(ch);
+        int width = CellWidth(ch);
+        int rowBytes = (width + 7) / 8;
+        int scaledWidth = width * m_nScale;
+        uint16_t* pOut = m_pCellBuffer;
+        for (int row = 0; row < m_nHeight; ++row) {
+            const uint8_t* pRow = ix == -1 ? NULL : m_pAtlas + m_nOffset[ix] + row * rowBytes;
+            // build one scaled row and then copy it for the rest of the scale
+            uint16_t* pLine = pOut;
+            for (int col = 0; col < width; ++col) {
+                bool on = pRow && (pRow[col / 8] & (0x80 >> (col % 8)));
+                for (int sx = 0; sx < m_nScale; ++sx)
+                    *pOut++ = on ? m_fgColor : m_bgColor;
+            }
+            for (int sy = 1; sy < m_nScale; ++sy) {
+                memcpy(pOut, pLine, scaledWidth * sizeof(uint16_t));
+                pOut += scaledWidth;
+            }
+        }
+        m_pTft->pushImage(x, y, scaledWidth, m_nHeight * m_nScale, m_pCellBuffer);
+    }
+public:
+    // build the atlas from the font, scale is how many display pixels for each font pixel
+    void begin(TFT_eSPI* pTft, const GFXfont* font, int scale, uint16_t fg = TFT_WHITE, uint16_t bg = TFT_BLACK)
+    {
+        m_pTft = pTft;
+        m_nScale = scale;
+        m_fgColor = fg;
+        m_bgColor = bg;
+        // find the size of the cells
+        int ascent = 0, descent = 0, size = 0, maxWidth = 0;
+        for (int ix = 0; ix < AtlasCount; ++ix) {
+            const GFXglyph* glyph = &font->glyph[BIG_DIGITS_CHARS[ix] - font->first];
+            int yOffset = (int8_t)pgm_read_byte(&glyph->yOffset);
+            ascent = max(ascent, -yOffset);
+            descent = max(descent, yOffset + pgm_read_byte(&glyph->height));
+            m_nWidth[ix] = pgm_read_byte(&glyph->xAdvance);
+            m_nOffset[ix] = size;
+            maxWidth = max(maxWidth, (int)m_nWidth[ix]);
+            size += (m_nWidth[ix] + 7) / 8;
+        }
+        m_nBaseline = ascent;
+        m_nHeight = ascent + descent;
+        for (int ix = 0; ix < AtlasCount; ++ix) {
+            m_nOffset[ix] *= m_nHeight;
+        }
+        size *= m_nHeight;
+        // blanks are the width of a digit
+        m_nBlankWidth = m_nWidth[0];
+        delete[] m_pAtlas;
+        delete[] m_pCellBuffer;
+        m_pAtlas = new uint8_t[size];
+        memset(m_pAtlas, 0, size);
+        m_pCellBuffer = new uint16_t[maxWidth * scale * m_nHeight * scale];
+        // unpack the glyph bits into the cells, the font bits run on from row to row
+        for (int ix = 0; ix < AtlasCount; ++ix) {
+            const GFXglyph* glyph = &font->glyph[BIG_DIGITS_CHARS[ix] - font->first];
+            const uint8_t* bitmap = font->bitmap + pgm_read_word(&glyph->bitmapOffset);
+            int w = pgm_read_byte(&glyph->width);
+            int h = pgm_read_byte(&glyph->height);
+            int xo = (int8_t)pgm_read_byte(&glyph->xOffset);
+            int yo = (int8_t)pgm_read_byte(&glyph->yOffset);
+            int rowBytes = (m_nWidth[ix] + 7) / 8;
+            int bit = 0;
+            for (int gy = 0; gy < h; ++gy) {
+                for (int gx = 0; gx < w; ++gx, ++bit) {
+                    if (!(pgm_read_byte(&bitmap[bit / 8]) & (0x80 >> (bit % 8))))
+                        continue;
+                    int x = xo + gx;
+                    int y = m_nBaseline + yo + gy;
+                    if (x < 0 || x >= m_nWidth[ix] || y < 0 || y >= m_nHeight)
+                        continue;
+                    m_pAtlas[m_nOffset[ix] + y * rowBytes + x / 8] |= 0x80 >> (x % 8);
+                }
+            }
+        }
+        m_bValid = false;
+    }
+    // the height in display pixels
+    int height()
+    {
+        return m_nHeight * m_nScale;
+    }
+    // the next draw() sends everything
+    void invalidate()
+    {
+        m_bValid = false;
+    }
+    // draw the text centered on the line at y, only the cells that are different from last time are sent
+    void draw(int y, const char* text)
+    {
+        if (m_pTft == NULL)
+            return;
+        int count = min((int)strlen(text), BIG_DIGITS_MAX_CELLS);
+        int width = 0;
+        for (int ix = 0; ix < count; ++ix)
+            width += CellWidth(text[ix]) * m_nScale;
+        int left = (m_pTft->width() - width) / 2;
+        // if the layout moved, clear what was there and draw it all
+        if (m_bValid && (left != m_nLastLeft || left + width != m_nLastRight || (int)strlen(m_lastText) != count)) {
+            m_pTft->fillRect(m_nLastLeft, y, m_nLastRight - m_nLastLeft, height(), m_bgColor);
+            m_bValid = false;
+        }
+        m_pTft->startWrite();
+        int x = left;
+        for (int ix = 0; ix < count; ++ix) {
+            if (!m_bValid || m_lastText[ix] != text[ix] || m_lastX[ix] != x) {
+                DrawCell(x, y, text[ix]);
+            }
+            m_lastText[ix] = text[ix];
+            m_lastX[ix] = x;
+            x += CellWidth(text[ix]) * m_nScale;
+        }
+        m_pTft->endWrite();
+        m_lastText[count] = '\0';
+        m_nLastLeft = left;
+        m_nLastRight = left + width;
+        m_bValid = true;
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include <Arduino.h>
+// watches the filament coming off a spool for a tangle, which either stops the feed or pulls hard on the spool
+// everything is exponential averages, so each conversion is a few multiplies and there is nothing to keep but them
+//
+// the rate is the trend of the weight, for a steady drop an average lags behind by the rate times its time
+// constant, so the gap between a fast and a slow average divided by the difference in time constants is the rate
+// the feed has stalled when the rate falls well below its own long average while the printer was using filament
+// the noise in the weight sets how quickly that can be seen, at a gram or two a minute it takes 40 to 60 seconds
+//
+// a tension spike is a conversion that is far from the smoothed weight compared to the usual spread
+// a few of them close together is a pull on the spool, that shows within a second or two
+#define FEED_FAST_SECONDS 3.0           // the time constants of the weight averages the rate comes from
+#define FEED_SLOW_SECONDS 15.0
+#define FEED_BASELINE_SECONDS 300.0     // the normal rate
+#define FEED_MIN_RATE 0.3               // g/min, the baseline has to be above this for the printer to be using filament
+#define FEED_STALL_FRACTION 0.25        // stalled when the rate is below this much of the baseline
+#define FEED_STALL_SECONDS 8            // for this long
+#define FEED_NOISE_SECONDS 60.0         // the spread of the conversions around the smoothed weight
+#define FEED_SPIKE_SIGMAS 6
+#define FEED_SPIKE_GRAMS 3.0            // smaller than this is never a spike
+#define FEED_SPIKE_SECONDS 2.0          // the spike count decays with this time constant
+#define FEED_TENSION_SPIKES 3           // this many close together is a pull on the spool
+#define FEED_HOLD_SECONDS 30            // the tension alarm stays on this long after the last spike
+class CFeedMonitor {
+private:
+    bool m_bStarted = false;
+    float m_fast = 0, m_slow = 0;       // grams
+    float m_rate = 0;                   // g/min
+    float m_baseline = 0;
+    float m_stallSeconds = 0;           // how long the rate has been low
+    float m_variance = 0;               // of the conversions around the smoothed weight
+    float m_spikes = 0;
+    float m_holdSeconds = 0;
+    bool m_bStalled = false;
+    // the weight of a new value for an average with time constant tau, close to 1 - exp(-seconds / tau)
+    static float Alpha(float seconds, float tau)
+    {
+        return seconds / (tau + seconds);
+    }
+public:
+    // start over, for a new spool or when the usage is reset
+    void reset()
+    {
+        *this = CFeedMonitor();
+    }
+    // add a conversion, grams is the smoothed weight, rawGrams is the same conversion without smoothing
+    // seconds is the time since the last one
+    void add(float grams, float rawGrams, float seconds)
+    {
+        if (!m_bStarted) {
+            m_fast = m_slow = grams;
+            m_bStarted = true;
+            return;
+        }
+        m_fast += (grams - m_fast) * Alpha(seconds, FEED_FAST_SECONDS);
+        m_slow += (grams - m_slow) * Alpha(seconds, FEED_SLOW_SECONDS);
+        m_rate = (m_slow - m_fast) / (FEED_SLOW_SECONDS - FEED_FAST_SECONDS) * 60;
+        bool bPrinting = m_baseline >= FEED_MIN_RATE;
+        // a stall doesn't pull the baseline down, or a long one would look normal
+        if (!m_bStalled)
+            m_baseline += (max(m_rate, 0.0f) - m_baseline) * Alpha(seconds, FEED_BASELINE_SECONDS);
+        if (bPrinting && m_rate < m_baseline * FEED_STALL_FRACTION)
+            m_stallSeconds += seconds;
+        else
+            m_stallSeconds = 0;
+        // it is over when the filament is moving again, or the printer has stopped for good
+        if (m_stallSeconds >= FEED_STALL_SECONDS)
+            m_bStalled = true;
+        else if (m_bStalled && m_rate >= m_baseline * FEED_STALL_FRACTION)
+            m_bStalled = false;
+        if (m_bStalled && m_stallSeconds >= FEED_BASELINE_SECONDS) {
+            m_bStalled = false;
+            m_baseline = 0;
+        }
+        // spikes, they are left out of the spread so a pull doesn't hide the next one
+        float residual = rawGrams - grams;
+        float limit = max((float)FEED_SPIKE_GRAMS, FEED_SPIKE_SIGMAS * sqrtf(m_variance));
+        m_spikes -= m_spikes * Alpha(seconds, FEED_SPIKE_SECONDS);
+        if (fabsf(residual) > limit) {
+            if (bPrinting)
+                m_spikes += 1;
+        }
+        else {
+            m_variance += (residual * residual - m_variance) * Alpha(seconds, FEED_NOISE_SECONDS);
+        }
+        if (m_spikes >= FEED_TENSION_SPIKES)
+            m_holdSeconds = FEED_HOLD_SECONDS;
+        else
+            m_holdSeconds = max(0.0f, m_holdSeconds - seconds);
+    }
+    // g/min from the trend of the weight
+    float rate()
+    {
+        return m_rate;
+    }
+    float baseline()
+    {
+        return m_baseline;
+    }
+    bool stalled()
+    {
+        return m_bStalled;
+    }
+    bool tension()
+    {
+        return m_holdSeconds > 0;
+    }
+};
@@ -1,5 +1,5 @@
 #pragma once
-#include <HX711_ADC.h>
+#include "LoadCell.h"
 #include <EEPROM.h>
 #include <TFT_eSPI.h>
 //#include <vector>
@@ -13,9 +13,34 @@
 
 #include "RotaryDialButton.h"
 #include "fonts.h"
+#include "BigDigits.h"
+#include "WeightGraph.h"
+#include "WeightLog.h"
+#include "SpoolStats.h"
+#include "SpoolDb.h"
+#include "ScaleStream.h"
+#include "SeqLock.h"
+#include "Profiler.h"
+#include "FeedMonitor.h"
+#include "Telemetry.h"
 #include <time.h>
+#include <esp_sleep.h>
+#include <driver/uart.h>
+// define TELEMETRY to publish the scale state over Wi-Fi, it is left out by default since the Wi-Fi stack is big
+//#define TELEMETRY
+#ifdef TELEMETRY
+#include <WiFi.h>
+#endif
 
+// load cells, they share the HX711 clock and each has its own data pin, see LoadCellPins
+#define LOADCELL_CHANNELS 1
+static_assert(LOADCELL_CHANNELS <= 6, "the status screen has room for six load cells");
+#if LOADCELL_CHANNELS > 1
+// the settings have a value for each load cell, so they don't fit the single load cell layout
+char VersionString[] = "01.01m";
+#else
 char VersionString[] = "01.01";
+#endif
 
 // use these to control the LCD brightness
 const int freq = 5000;
@@ -40,6 +65,21 @@ const int resolution = 8;
 
 // display things
 TFT_eSPI tft = TFT_eSPI();       // Invoke custom library
+const GFXfont* pTextFont = &Dialog_bold_16;    // the font for everything, FormatMultiLine() measures with it
+// the weight in big characters
+CBigDigits BigWeight;
+#define BIG_WEIGHT_SCALE 3
+bool bBigWeight = true;         // show the weight with BigWeight instead of a text line
+// the weight history graph, turn the dial on the status screen to see it
+CWeightGraph WeightGraph;
+int nGraphMinutes = 60;         // time across the graph
+bool bGraphScreen = false;      // set when the graph is showing instead of the numbers
+// the weight log in flash
+CWeightLog WeightLog;
+// filament used by each spool over the last day, week, month, and year
+CSpoolStats<LOADCELL_CHANNELS> SpoolStats;
+// the spool records, see SpoolDb.h
+CSpoolDb SpoolDb;
 #define TFT_ENABLE 4
 // settings
 CRotaryDialButton::ROTARY_DIAL_SETTINGS DialSettings;
@@ -51,18 +91,49 @@ bool bAllowMenuWrap = false;
 uint16_t menuLineColor = TFT_CYAN;
 uint16_t menuLineActiveColor = TFT_WHITE;
 
-// keep a list of spool weights
+// the spool weights from before there was a spool database, they are only read to move them into it
 #define MAX_SPOOL_WEIGHTS 100
-// for the user we make the index 1 based, so use this macro to access
-#define SPOOL_INDEX (nActiveSpool-1)
 int SpoolWeights[MAX_SPOOL_WEIGHTS];
-int nActiveSpool = 1;	// the currently selected spool
-float calibrationValue; // calibration value
-long tareOffset;
+// for the user we make the index 1 based, so use these macros to access
+#define CHANNEL_INDEX (nLoadCell-1)
+#define ACTIVE_SPOOL (nActiveSpool[CHANNEL_INDEX])
+int nLoadCell = 1;		// the load cell that the menus, wizards, and status numbers are for
+int nActiveSpool[LOADCELL_CHANNELS] = { 1 };	// the spool on each load cell
+float calibrationValue[LOADCELL_CHANNELS]; // calibration value
+long tareOffset[LOADCELL_CHANNELS];
+// these are in each spool record now, they are only read to move them into it
 long nLengthConversion = 33312;		// implied 2 decimals
-#define LENGTH_CONVERSION ((float)(nLengthConversion) / 100)
 int fullSpoolFilament = 1000;		// grams on a full spool
+// the active spool's record while the spool menu changes it
+struct SPOOLEDIT {
+	int emptyGrams;
+	int netGrams;
+	int density;
+	int diameter;
+};
+SPOOLEDIT SpoolEdit;
 int serialPrintInterval = 2; //increase value to slow down serial print activity, seconds
+// the HX711 input and gain, channel A is the load cell connector
+const char* LoadCellGainNames[] = { "A 128", "A 64", "B 32" };
+const int LoadCellGains[] = { HX711_GAIN_A128, HX711_GAIN_A64, HX711_GAIN_B32 };
+int nLoadCellGain = 0;
+// how quickly the weight follows changes, the filter is noisier when it is faster
+const char* ResponseProfileNames[] = { "Smooth", "Normal", "Fast" };
+int nResponseProfile = 1;
+// what to do when a spool is put on, auto picks the closest match when no other spool is near it
+const char* SpoolIdentifyNames[] = { "Off", "Ask", "Auto" };
+int nSpoolIdentify = 2;
+// the runout alarm, 0 turns either test off
+int nRunoutGrams = 0;           // filament left
+int nRunoutMinutes = 0;         // time left at the usage rate
+bool bRunoutHigh = false;       // the pin level for running out, printers usually want low
+bool bFeedAlarm = false;        // a stalled feed or a pull on the spool sets the runout pin too
+int nIdleMinutes = 15;          // nothing happening for this long goes idle, 0 never does
+// telemetry, it starts once there is an SSID, the broker is optional since the WebSocket feed works without it
+char WifiSsid[33] = "";
+char WifiPassword[65] = "";
+char MqttHost[65] = "";
+int nMqttPort = 1883;
 
 struct saveValues {
     void* val;
@@ -71,14 +142,134 @@ struct saveValues {
 // these values are saved in eeprom, the version is first
 const saveValues saveValueList[] = {
     {VersionString,sizeof(VersionString)},                      // first
-	{&calibrationValue, sizeof(calibrationValue)},
-	{&tareOffset, sizeof(tareOffset)},
+	{calibrationValue, sizeof(calibrationValue)},
+	{tareOffset, sizeof(tareOffset)},
 	{&nLengthConversion, sizeof(nLengthConversion)},
 	{&fullSpoolFilament, sizeof(fullSpoolFilament)},
-	{&nActiveSpool, sizeof(nActiveSpool)},
+	{nActiveSpool, sizeof(nActiveSpool)},
 	{SpoolWeights, sizeof(SpoolWeights)},
 	{&nDisplayBrightness,sizeof(nDisplayBrightness)},
+	{&bBigWeight,sizeof(bBigWeight)},
+	{&nGraphMinutes,sizeof(nGraphMinutes)},
+	{&nLoadCellGain,sizeof(nLoadCellGain)},
+	{&nResponseProfile,sizeof(nResponseProfile)},
+	{&nLoadCell,sizeof(nLoadCell)},
+	{&nSpoolIdentify,sizeof(nSpoolIdentify)},
+	{&nRunoutGrams,sizeof(nRunoutGrams)},
+	{&nRunoutMinutes,sizeof(nRunoutMinutes)},
+	{&bRunoutHigh,sizeof(bRunoutHigh)},
+	{&bFeedAlarm,sizeof(bFeedAlarm)},
+	{&nIdleMinutes,sizeof(nIdleMinutes)},
+	{WifiSsid,sizeof(WifiSsid)},
+	{WifiPassword,sizeof(WifiPassword)},
+	{MqttHost,sizeof(MqttHost)},
+	{&nMqttPort,sizeof(nMqttPort)},
+};
+// values were added to the end of the list after the first release, the length of the list that was saved
+// is kept at the end of the EEPROM and values past it keep their defaults when the settings are loaded
+// settings from before it was kept have 0xff there and only the values up to the display brightness
+#define SETTINGS_EEPROM_SIZE 1024
+#define SETTINGS_LENGTH_ADDRESS (SETTINGS_EEPROM_SIZE - sizeof(uint32_t))
+#define SETTINGS_FIRST_VALUES 8
+
+// where the time goes, see the Profiler page in the system menu or the profile serial command
+enum eProfileProbe {
+	eProfUpdate = 0, eProfGetData, eProfMath, eProfLoop, eProfRecord, eProfShowState, eProfDisplayLine, eProfHandleMenus, eProfShowMenu,
+	eProfInputQueue, eProfInputDraw, eProfInput, eProfUpdateGap, eProfLoopPeriod, eProfCount
+};
+CProfiler::PROBE ProfileProbes[eProfCount] = {
+	{"update"},
+	{"getData"},
+	{"math"},
+	{"loop"},
+	{"record"},
+	{"ShowScaleState"},
+	{"DisplayLine"},
+	{"HandleMenus"},
+	{"ShowMenu"},
+	{"input queue"},        // button edge to ReadButton()
+	{"input draw"},         // ReadButton() to the end of the drawing it caused
+	{"input total"},        // button edge to pixels
+	{"update gap"},         // between update() calls in the acquisition task
+	{"loop period"},        // between the starts of loop()
 };
+CProfiler Profiler(ProfileProbes, eProfCount);
+// input latency tracing, a button is followed until the loop() pass that draws something after it
+#define INPUT_TRACE_TIMEOUT_US 1000000  // an input that draws nothing for this long isn't counted
+int64_t inputTraceTime = 0;             // when the button happened, 0 when nothing is being traced
+int64_t inputReadTime = 0;              // when ReadButton() got it
+bool bInputDrawn = false;               // something was drawn after it
+
+// timing health, see the Diagnostics page in the system menu or the diag serial command
+#define HX711_SPS 10                    // assumed until the rate has been measured, the HX711 RATE pin picks 10 or 80
+#define DIAG_WINDOW_MS 5000             // the achieved rate is counted over this long
+#define DIAG_ALARM_SPS_PERCENT 90       // alarm when the achieved rate is below this much of HX711_SPS
+#define DIAG_ALARM_LOOP_MS 250          // or loop() took longer than this
+#define DIAG_ALARM_REPEAT_MS 60000      // don't nag more often than this
+unsigned long diagAlarmTime = 0;        // millis() of the last alarm
+unsigned long diagLastMissed = 0;       // missed conversions at the last check
+uint32_t diagLastLoopMax = 0;           // loop period max at the last check
+
+// binary streaming to a host, see ScaleStream.h, a host sends "subscribe" on the serial port to start it
+volatile uint8_t nStreamSubscriptions = 0;  // STREAM_SUB_ bits, the acquisition task reads this
+uint16_t nStreamSequence = 0;
+CStreamFrame StreamSamples;             // samples waiting to be sent
+int nStreamSamples = 0;
+unsigned long streamSamplesStart;       // millis() when the first one went in
+unsigned long streamStateTime;          // millis() when the state was sent
+unsigned long nStreamDropped = 0;       // frames that didn't fit in the serial buffer
+#define STREAM_BATCH_MS 100             // longest a sample waits to be sent
+#define STREAM_STATE_MS 1000
+#define SERIAL_TX_BUFFER 2048
+
+// idle, when nothing has happened for nIdleMinutes the HX711 is powered down, the backlight goes off, and the ESP32
+// light sleeps, it wakes every IDLE_SAMPLE_SECONDS to weigh, and comes back for the dial, a button, the serial port,
+// or a weight change, RAM is kept in light sleep so everything carries on from where it was
+#define IDLE_SAMPLE_SECONDS 30
+#define IDLE_WAKE_GRAMS 5.0             // a change this big on any load cell
+#define IDLE_BURST_TIMEOUT_MS 5000      // give up on a weighing that doesn't fill the dataset
+#define IDLE_UART_EDGES 3               // the serial port wakes it, the characters that do it are lost
+bool bIdle = false;
+bool bIdleBurst = false;                // the HX711 is on for a weighing
+unsigned long idleBurstConversions;     // the conversion count that fills the dataset
+unsigned long idleBurstStart;           // millis()
+float IdleWeights[LOADCELL_CHANNELS];   // what was on the load cells when it went idle
+unsigned long lastActivityTime = 0;     // millis() of the last button, command, or weight change
+// the buttons are low when pressed and get their falling edge interrupts back after a sleep, the dial can be either
+const gpio_num_t IdleButtonPins[] = { DIAL_BTN, GPIO_NUM_0, GPIO_NUM_35 };
+const gpio_num_t IdleDialPins[] = { DIAL_A, DIAL_B };
+int64_t lastLoopStart = 0;              // for the loop period, 0 after a sleep so that isn't counted
+
+// telemetry, the scale state goes to an MQTT broker and to WebSocket clients, see Telemetry.h for the messages
+// it has its own task under the acquisition task on core 0, which is where the Wi-Fi stack runs, and it only reads
+// the published state, so a slow or missing network holds up nothing but itself
+// the light sleep would drop Wi-Fi, so it doesn't go idle while telemetry is running
+#define TELEMETRY_CORE 0
+#define TELEMETRY_STACK 6144
+#define TELEMETRY_PRIORITY 1
+#define TELEMETRY_POLL_MS 10            // the published state is looked at this often, quicker than 80 SPS
+#define TELEMETRY_RETRY_MS 10000        // between tries at the broker
+#define TELEMETRY_WS_PORT 81
+#define TELEMETRY_TOPIC "filamentscale" // topics are filamentscale/<last 3 MAC bytes>/<load cell>/<kind>
+volatile bool bTelemetryOn = false;     // there is a network to join, the task waits without one
+// the task has its own copy of the settings, the wifi and mqtt commands send it a new one so it never sees them half changed
+struct TELEMETRYSETTINGS {
+	char ssid[sizeof(WifiSsid)];
+	char password[sizeof(WifiPassword)];
+	char host[sizeof(MqttHost)];
+	int port;
+};
+QueueHandle_t TelemetrySettingsQueue = NULL;    // holds the latest
+TaskHandle_t TelemetryTaskHandle = NULL;
+// for the telemetry command, the task keeps these up to date
+volatile bool bMqttConnected = false;
+volatile int nWebSocketClients = 0;
+volatile unsigned long nTelemetrySent = 0;      // messages
+volatile unsigned long nTelemetryCoalesced = 0; // conversions that didn't change the state enough to send it
+
+// the line where toasts show up
+#define TOAST_LINE 6
+#define TOAST_TIME 1500
 
 // functions
 void WriteMessage(String txt, bool error = false, int wait = 2000, bool process = false);
@@ -86,6 +277,7 @@ bool HandleMenus();
 void ShowMenu(struct MenuItem* menu);
 void GetIntegerValue(MenuItem* menu);
 void ToggleBool(MenuItem* menu);
+void NextListItem(MenuItem* menu);
 void CalculateSpoolWeight(MenuItem* menu = NULL);
 void Calibrate(MenuItem* menu = NULL);
 void DisplayLine(int line, String text, int16_t color = TFT_WHITE);
@@ -93,13 +285,24 @@ void DisplayMenuLine(int line, int displine, String text);
 void SetFactorySettings(MenuItem* menu);
 void SaveSpoolSettings(MenuItem* menu = NULL);
 void LoadSpoolSettings(MenuItem* menu = NULL);
-void ChangeSpoolWeight(MenuItem* menu);
 void WeighEmptySpool(MenuItem* menu);
-void SetMenuDisplayWeight(MenuItem* menu, int flag);
+void SetMenuSpoolField(MenuItem* menu, int flag);
 void SetMenuDisplayBrightness(MenuItem* menu, int flag);
+void SetMenuGraphMinutes(MenuItem* menu, int flag);
+void SetMenuLoadCellGain(MenuItem* menu, int flag);
+void SetMenuResponseProfile(MenuItem* menu, int flag);
+void SetMenuActiveSpool(MenuItem* menu, int flag);
+void SetMenuLoadCell(MenuItem* menu, int flag);
+void SetMenuSpoolIdentify(MenuItem* menu, int flag);
+void SendLogToSerial(MenuItem* menu);
+void ShowProfiler(MenuItem* menu);
+void ShowDiagnostics(MenuItem* menu);
+void ShowSpoolUsage(MenuItem* menu);
+void TakeInventory(MenuItem* menu);
 void SetTare(MenuItem* menu = NULL);
 void ResetUsage(MenuItem* menu = NULL);
 bool SaveLoadSettings(bool save, bool bOnlySignature = false);
+void ShowToast(String text, uint16_t color = TFT_WHITE, int duration = TOAST_TIME);
 
 bool bAutoLoadSettings = false;
 
@@ -139,18 +342,49 @@ typedef struct MenuItem {
 	const char* on;                     // text for boolean true
 	const char* off;                    // text for boolean false
 	// flag is 1 for first time, 0 for changes, and -1 for last call, bools only call this with -1
+	// it is called with -2 before the item is shown, so the value can follow the load cell or spool
 	void(*change)(MenuItem*, int flag); // call for each change, example: brightness change show effect, can be NULL
 	const char** nameList;              // used for multichoice of items, example wiring mode, .max should be count-1 and .min=0
 	const char* cHelpText;              // a place to put some menu help
 };
 
+// cooperative UI tasks, these are wizards and messages that run a step at a time from loop()
+// so the scale keeps being read while they wait for buttons, tares, and settling
+struct UITASK;
+// called with the next button (or BTN_NONE), return true when finished
+typedef bool (*UiTaskFunction)(struct UITASK* task, CRotaryDialButton::Button btn);
+struct UITASK {
+	UiTaskFunction function;
+	MenuItem* menu;             // the menu item that started this, can be NULL
+	int step;                   // which step we are on, starts at 0
+	unsigned long timer;        // millis() that a timed step is waiting for
+	unsigned long conversions;  // conversion count that a settling step is waiting for
+	int wait;                   // message display time, -1 waits for a button
+	// used by the integer editor
+	int stepSize;
+	int value;                  // the copy being edited, the menu value is only set when it is accepted
+	int originalValue;
+	int lastValue;
+};
+typedef UITASK UiTask;
+std::stack<UiTask> UiTaskStack;
+void StartUiTask(UiTaskFunction function, MenuItem* menu = NULL);
+bool bRedrawStatus = true;      // set to redraw the whole status screen
+// the load cell dataset has these samples beyond the ones in use
+#define DATASET_EXTRA_SAMPLES LOADCELL_IGNORE
+
 MenuItem SpoolMenu[] = {
 	{eExit,"Previous Menu"},
-	{eTextInt,"Active Spool: %2d",GetIntegerValue,&nActiveSpool,1,MAX_SPOOL_WEIGHTS},
+	{eTextInt,"Active Spool: %2d",GetIntegerValue,NULL,1,MAX_SPOOLS,0,NULL,NULL,SetMenuActiveSpool},
+	{eList,"Identify Spool: %s",NextListItem,&nSpoolIdentify,0,2,0,NULL,NULL,SetMenuSpoolIdentify,SpoolIdentifyNames,"Find the spool by its weight when it is put on the scale"},
 	{eText,"Spool Wt from Full",CalculateSpoolWeight},
 	{eTextInt,"Weigh Empty Spool",WeighEmptySpool},
-	{eTextInt,"Empty Spool Wt: %d g",ChangeSpoolWeight,NULL,1,2000,0,NULL,NULL,SetMenuDisplayWeight},
-	{eTextInt,"Full Filament Wt: %d g",GetIntegerValue,&fullSpoolFilament,100,2000},
+	{eTextInt,"Empty Spool Wt: %d g",GetIntegerValue,&SpoolEdit.emptyGrams,0,2000,0,NULL,NULL,SetMenuSpoolField},
+	{eTextInt,"Full Filament Wt: %d g",GetIntegerValue,&SpoolEdit.netGrams,100,3000,0,NULL,NULL,SetMenuSpoolField},
+	{eTextInt,"Density: %d.%03d g/cm3",GetIntegerValue,&SpoolEdit.density,800,2500,3,NULL,NULL,SetMenuSpoolField,NULL,"PLA 1.24, PETG 1.27, ABS 1.04, TPU 1.21"},
+	{eTextInt,"Diameter: %d.%02d mm",GetIntegerValue,&SpoolEdit.diameter,100,300,2,NULL,NULL,SetMenuSpoolField},
+	{eText,"Spool Usage History",ShowSpoolUsage},
+	{eText,"Inventory",TakeInventory,NULL,0,0,0,NULL,NULL,NULL,NULL,"Weigh spools one after another, send the list with the inventory command"},
 	{eText,"Save Settings",SaveSpoolSettings},
 	//{eText,"Load Spool Settings",LoadSpoolSettings},
 	{eExit,"Previous Menu"},
@@ -161,7 +395,12 @@ MenuItem ScaleMenu[] = {
 	{eExit,"Previous Menu"},
 	{eText,"Tare (reset zero)",SetTare},
 	{eText,"Calibrate Weight",Calibrate},
-	{eTextInt,"Wt to Length: %d.%02d",GetIntegerValue,&nLengthConversion,30000,40000,2},
+	{eList,"Input: %s",NextListItem,&nLoadCellGain,0,2,0,NULL,NULL,SetMenuLoadCellGain,LoadCellGainNames,"HX711 channel and gain, channel B needs a new tare and calibration"},
+	{eList,"Response: %s",NextListItem,&nResponseProfile,0,2,0,NULL,NULL,SetMenuResponseProfile,ResponseProfileNames,"Fast follows changes sooner but the weight is noisier"},
+	{eTextInt,"Runout at: %d g",GetIntegerValue,&nRunoutGrams,0,1000,0,NULL,NULL,NULL,NULL,"Set the runout pin when this much filament is left, 0 is off"},
+	{eTextInt,"Runout at: %d Min",GetIntegerValue,&nRunoutMinutes,0,600,0,NULL,NULL,NULL,NULL,"Set the runout pin when this much time is left, 0 is off"},
+	{eBool,"Runout Pin: %s",ToggleBool,&bRunoutHigh,0,0,0,"High","Low",NULL,NULL,"The level for running out, the other level is let float for the printer's pull up"},
+	{eBool,"Tangle to Runout: %s",ToggleBool,&bFeedAlarm,0,0,0,"On","Off",NULL,NULL,"A stalled feed or a pull on the spool sets the runout pin so the printer pauses"},
 	{eText,"Save Settings",SaveSpoolSettings},
 	{eExit,"Previous Menu"},
 	// make sure this one is last
@@ -172,7 +411,13 @@ MenuItem SystemMenu[] = {
 	{eBool,"Dial Type: %s",ToggleBool,&DialSettings.m_bToggleDial,0,0,0,"Toggle","Pulse"},
 	{eTextInt,"Display Brightness: %d",GetIntegerValue,&nDisplayBrightness,0,100,0,NULL,NULL,SetMenuDisplayBrightness},
 	{eTextInt,"Display Update: %dS",GetIntegerValue,&serialPrintInterval,1,30},
+	{eTextInt,"Sleep After: %d Min",GetIntegerValue,&nIdleMinutes,0,120,0,NULL,NULL,NULL,NULL,"Power down when nothing is happening, 0 is never"},
+	{eBool,"Big Weight: %s",ToggleBool,&bBigWeight,0,0,0,"On","Off"},
+	{eTextInt,"Graph Time: %d Min",GetIntegerValue,&nGraphMinutes,5,1440,0,NULL,NULL,SetMenuGraphMinutes},
 	{eText,"Save Settings",SaveSpoolSettings},
+	{eText,"Send Log to Serial",SendLogToSerial},
+	{eText,"Profiler",ShowProfiler},
+	{eText,"Diagnostics",ShowDiagnostics},
 	{eText,"Factory Settings",SetFactorySettings},
 	{eReboot,"Reboot System"},
 	{eExit,"Previous Menu"},
@@ -182,6 +427,9 @@ MenuItem SystemMenu[] = {
 MenuItem MainMenu[] = {
 	{eExit,"Main (Long Press)"},
 	{eText,"Reset Usage Rate",ResetUsage},
+#if LOADCELL_CHANNELS > 1
+	{eTextInt,"Load Cell: %d",GetIntegerValue,&nLoadCell,1,LOADCELL_CHANNELS,0,NULL,NULL,SetMenuLoadCell},
+#endif
 	{eMenu,"Spool Settings",{.menu = SpoolMenu}},
 	{eMenu,"Scale Settings",{.menu = ScaleMenu}},
 	{eMenu,"System Settings",{.menu = SystemMenu}},
@@ -202,15 +450,263 @@ std::stack<MenuInfo*> MenuStack;
 
 bool bMenuChanged = true;
 
+// toasts are short messages shown on the bottom line for a while, they don't stop anything
+struct TOAST {
+	String text;
+	uint16_t color;
+	int duration;   // mS
+};
+std::queue<TOAST> ToastQueue;       // the front one is showing
+#define MAX_TOASTS 4
+bool bToastShowing = false;
+unsigned long toastExpires;         // millis() when the showing toast is done
+bool bToastRedraw = false;          // set when the screen was cleared under the toast
+String toastLineText;               // what DisplayLine() put on the toast line, restored after the toasts
+uint16_t toastLineColor = TFT_WHITE;
+
 // load cell HX711 info
 // pins:
 const int HX711_dout = 21; //mcu > HX711 dout pin
 const int HX711_sck = 22; //mcu > HX711 sck pin
 bool bFoundLoadcell = true;
+// the runout output goes to a printer's filament runout sensor input
+// it is open drain so the printer's pull up sets the high level, even on a 5V board
+// the acquisition task sets it right after the conversion that crosses the threshold, so it changes within
+// one acquisition loop (a tick) plus the read of that conversion, well inside a sample period even at 80 SPS
+#define RUNOUT_PIN 25
+#define RUNOUT_HYSTERESIS_GRAMS 10      // the alarm clears this far above the threshold
+#define RUNOUT_HYSTERESIS_MINUTES 5
+// the HX711 needs this long after power up before the readings are good
+#define LOADCELL_STABILIZE_MS 400
+// no first reading after this long means the HX711 isn't there
+#define LOADCELL_TIMEOUT_MS 3000
+unsigned long loadcellDeadline = 0;
+bool bFirstReading = false;		// set when the first valid weight has been shown
 
-// HX711 constructor:
-HX711_ADC LoadCell(HX711_dout, HX711_sck);
+// startup trace, when each phase finished
+struct BOOTPHASE {
+	const char* name;
+	unsigned long ms;	// millis() at the end of the phase
+};
+#define MAX_BOOT_PHASES 10
+BOOTPHASE BootTrace[MAX_BOOT_PHASES];
+int nBootPhases = 0;
 
-// consumption rate numbers
-time_t usageStartTime = 0;
-long usageStartAmount = 0;
\ No newline at end of file
+// the HX711 driver, the clock pin then a data pin for each load cell, like CHX711Pins<HX711_sck, 21, 19, 18, 5> for four
+// define HX711_SPI_CLOCK to have the SPI peripheral clock the bits in, that only works with one load cell
+//#define HX711_SPI_CLOCK
+#ifdef HX711_SPI_CLOCK
+typedef CHX711SpiPins<HX711_sck, HX711_dout> LoadCellPins;
+#else
+typedef CHX711Pins<HX711_sck, HX711_dout> LoadCellPins;
+#endif
+static_assert(LoadCellPins::count == LOADCELL_CHANNELS, "LOADCELL_CHANNELS must match the data pins in LoadCellPins");
+CLoadCell<LoadCellPins> LoadCell;
+
+// consumption rate numbers for each load cell, these belong to the acquisition task
+// loop() reads them for the checkpoints, they only change when the usage starts over
+time_t usageStartTime[LOADCELL_CHANNELS];
+long usageStartAmount[LOADCELL_CHANNELS];
+// the filament when the restored checkpoint was made, what was used after it isn't in its elapsed time,
+// so the first reading after the restore takes it out of the start amount
+long usageCheckpointAmount[LOADCELL_CHANNELS];
+bool bUsageCatchUp[LOADCELL_CHANNELS];
+// the usage numbers are kept over a restart, in RTC memory that isn't cleared by a reboot or a brownout, and in
+// a file for when the power goes, the time restarts at boot so the checkpoint has how long the usage had been running
+#define USAGE_MAGIC 0x55534132          // "USA2", the checkpoints before this didn't have the amount
+#define USAGE_FILE "/usage.bin"
+#define USAGE_CHECKPOINT_MINUTES 10     // how often the file is written
+struct USAGECHECKPOINT {
+	uint32_t magic;
+	uint32_t elapsed[LOADCELL_CHANNELS];    // seconds since the usage started
+	int32_t startAmount[LOADCELL_CHANNELS];
+	int32_t amount[LOADCELL_CHANNELS];      // the filament then, -1 if there wasn't a good reading
+	int32_t spool[LOADCELL_CHANNELS];       // the usage is only for the same spool
+	uint32_t crc;                           // CRC-16 of everything before it
+};
+RTC_NOINIT_ATTR USAGECHECKPOINT RtcUsage;
+unsigned long usageFileTime = 0;        // millis() when the file was written
+bool bUsageCheckpoints = false;         // set once the usage has been restored or reset, saving the settings in setup() doesn't write one
+
+// the HX711 is read by the acquisition task on the other core, so drawing and menus never hold up sampling
+// everything else only sees the numbers it publishes and asks it to tare or calibrate with LoadCellRequests
+#define ACQUIRE_CORE 0              // loop() runs on core 1
+#define ACQUIRE_STACK 4096
+#define ACQUIRE_PRIORITY 2
+// the filter and the stability test for each response profile, the sample counts are worked out from the measured rate
+struct RESPONSEPROFILE {
+	int filterMs;           // the average covers this long
+	float stableGrams;      // the weight is stable when it doesn't move more than this
+	int stableMs;           // for this long
+};
+// normal is 16 samples and 8 conversions at 10 SPS
+const RESPONSEPROFILE ResponseProfiles[] = {
+	{ 3200, 0.3, 1600 },
+	{ 1600, 0.5, 800 },
+	{ 400, 1.0, 400 },
+};
+#define SPS_DETECT_THRESHOLD 40     // the RATE pin gives 10 or 80, anything measured above this is 80
+#define SPS_DETECT_CONVERSIONS 8    // the measured rate is trusted after this many conversions
+// spool identification, a spool has been put on when the weight settles this far from where it last settled
+#define SPOOL_STEP_GRAMS 50
+#define SPOOL_PRESENT_GRAMS 50      // less than this is an empty load cell
+#define SPOOL_MATCH_GRAMS 30        // how far a spool can be from what it should weigh
+#define SPOOL_MATCH_MARGIN 20       // auto only picks the closest when the next one is this much further
+#define SPOOL_MATCH_MAX 4           // candidates to choose from
+#define SPOOL_REMAINING_MS 10000    // the same spool has to be stable this long before what is left on it is kept
+// the latest numbers calculated from a load cell, these are updated for every conversion
+// the acquisition numbers from conversions down are the same for all of them, since they are read together
+struct SCALESTATE {
+	unsigned long conversions;  // how many HX711 conversions there have been
+	bool bDataValid;        // set when the filter is full, the numbers below are good after that
+	float weight;           // everything on the load cell in grams
+	int filamentWeight;     // grams of filament left on the spool
+	int percent;            // of a full spool
+	float length;           // meters of filament left
+	bool bRateValid;        // set when there is a usage rate
+	double rate;            // grams per minute
+	double minutesLeft;     // -1 if not using any
+	bool bStable;           // the weight has stopped moving
+	float calFactor;        // what the HX711 is using
+	long tareOffset;
+	float sps;              // measured conversions per second
+	unsigned long tareCount;        // goes up when a tare finishes
+	unsigned long calibrateCount;   // goes up when a calibration finishes
+	unsigned long missedConversions;    // conversions that were over before update() got to them
+	float achievedSps;      // conversions per second over the last DIAG_WINDOW_MS
+	int detectedSps;        // 10 or 80, what the RATE pin is set to
+	int samplesInUse;       // in the filter average
+	int stableConversions;  // for the weight to be stable
+	unsigned long placements;   // goes up when a spool is put on
+	float placedWeight;     // what it weighed when it settled
+	bool bRunout;           // the filament is below a runout threshold
+	float feedRate;         // g/min from the trend of the weight, see FeedMonitor.h
+	bool bFeedStalled;      // the filament stopped coming off the spool while printing
+	bool bFeedTension;      // something pulled hard on the spool
+	bool bPoweredDown;      // the HX711 is off for idle
+};
+CSeqLock<SCALESTATE> PublishedState[LOADCELL_CHANNELS];    // written by the acquisition task
+SCALESTATE ScaleStates[LOADCELL_CHANNELS];  // the copies loop() takes every time round
+SCALESTATE ScaleState;                      // the one for nLoadCell
+// set when the active spool is the one on the load cell, then its remaining filament follows the scale
+// it is cleared when a spool is put on that couldn't be identified, until one is picked
+bool bSpoolKnown[LOADCELL_CHANNELS];
+// when the spool on each load cell started being stable, 0 when it isn't, and which spool it was
+unsigned long spoolStableTime[LOADCELL_CHANNELS];
+int spoolStableSpool[LOADCELL_CHANNELS];
+// the spools that could be the one that was put on, for the identify task
+CSpoolDb::SPOOLMATCH SpoolMatches[SPOOL_MATCH_MAX];
+int nSpoolMatches = 0;
+int nIdentifyChannel = 0;
+int nIdentifyChoice = 0;
+float identifyGrams = 0;
+// inventory, spools are weighed one after another and the results are kept until the inventory command sends them
+#define MAX_INVENTORY 200
+struct INVENTORYITEM {
+	time_t time;
+	int spool;              // 0 if it didn't match and couldn't be given a number
+	bool bNew;              // it didn't match, so it was given a free spool and taken to be full
+	int filamentWeight;     // grams
+	float length;           // meters
+	float weight;           // everything on the load cell
+};
+INVENTORYITEM InventoryItems[MAX_INVENTORY];
+int nInventoryItems = 0;
+// eRequestTune uses nLoadCellGain, nResponseProfile, calibrationValue and tareOffset, it and eRequestResetUsage are for all the load cells
+// eRequestPowerDown and eRequestPowerUp are for idle
+enum eLoadCellRequest { eRequestTare, eRequestCalibrate, eRequestResetUsage, eRequestTune, eRequestPowerDown, eRequestPowerUp };
+struct LOADCELLREQUEST {
+	eLoadCellRequest op;
+	int channel;            // the load cell for eRequestTare and eRequestCalibrate
+	float grams;            // the known mass for eRequestCalibrate
+};
+QueueHandle_t LoadCellRequests;
+// conversions waiting to go out on the binary stream
+struct STREAMSAMPLE {
+	uint32_t micros;
+	int32_t counts;
+	float grams;
+};
+#define STREAM_QUEUE_LENGTH 64
+QueueHandle_t StreamSampleQueue;
+
+// commands typed on the serial port, each one gets a line starting with "ok" or "error:" back
+// the commands do the same things as the menus so a script can set up a scale
+String SerialLine;
+#define SERIAL_LINE_MAX 128
+bool bSerialLineTooLong = false;    // the rest of the line is thrown away and it isn't run
+typedef void (*SerialCommandFunction)(String arg);
+struct SERIALCOMMAND {
+	const char* name;
+	const char* args;           // for help
+	SerialCommandFunction function;
+	const char* help;
+};
+typedef SERIALCOMMAND SerialCommand;
+// a spool record from an import line
+struct SPOOLIMPORT {
+	int spool;
+	int grams;              // the empty spool
+	int net;                // -1 when only the empty weight was given
+	int density;
+	int diameter;
+};
+void CmdHelp(String arg);
+void CmdSubscribe(String arg);
+void CmdUnsubscribe(String arg);
+void CmdWeight(String arg);
+void CmdLoadCell(String arg);
+void CmdSpool(String arg);
+void CmdSpoolWeight(String arg);
+void CmdFullWeight(String arg);
+void CmdMaterial(String arg);
+void CmdTare(String arg);
+void CmdCalibrate(String arg);
+void CmdExport(String arg);
+void CmdImport(String arg);
+void CmdInventory(String arg);
+void CmdRunout(String arg);
+void CmdSleep(String arg);
+#ifdef TELEMETRY
+void CmdWifi(String arg);
+void CmdMqtt(String arg);
+void CmdTelemetry(String arg);
+#endif
+void CmdSave(String arg);
+void CmdProfile(String arg);
+void CmdLatency(String arg);
+void CmdDiag(String arg);
+SerialCommand SerialCommands[] = {
+	{"help","",CmdHelp,"list the commands"},
+	{"subscribe","[samples|state|all]",CmdSubscribe,"start the binary stream"},
+	{"unsubscribe","[samples|state|all]",CmdUnsubscribe,"stop the binary stream"},
+	{"weight","",CmdWeight,"show the weight and the filament left"},
+	{"loadcell","[number]",CmdLoadCell,"show or set the load cell the other commands are for"},
+	{"spool","[number]",CmdSpool,"show or set the active spool"},
+	{"spoolweight","[grams]",CmdSpoolWeight,"show or set the empty weight of the active spool"},
+	{"fullweight","[grams]",CmdFullWeight,"show or set the filament on the active spool when it is full"},
+	{"material","[density diameter]",CmdMaterial,"show or set the active spool's filament, mg/cm3 and 1/100 mm"},
+	{"tare","",CmdTare,"zero the scale, take the spool off first"},
+	{"calibrate","grams",CmdCalibrate,"calibrate with a known mass on the tared scale"},
+	{"export","",CmdExport,"list the spool records as import commands"},
+	{"import","spool=grams[/net/density/diameter] ...",CmdImport,"set spool records"},
+	{"inventory","[clear]",CmdInventory,"list the spools weighed in inventory mode"},
+	{"runout","[grams [minutes]]",CmdRunout,"show or set the runout alarm thresholds, 0 is off"},
+	{"sleep","[minutes]",CmdSleep,"show or set the idle time before it sleeps, 0 is never"},
+#ifdef TELEMETRY
+	{"wifi","[ssid [password]]",CmdWifi,"show or set the Wi-Fi network for telemetry"},
+	{"mqtt","[host [port]]",CmdMqtt,"show or set the MQTT broker, - for none"},
+	{"telemetry","",CmdTelemetry,"show the Wi-Fi, broker, and WebSocket status"},
+#endif
+	{"save","",CmdSave,"save the settings"},
+	{"profile","[reset]",CmdProfile,"print or clear the time histograms"},
+	{"latency","",CmdLatency,"p50 and p99 from a button to the display"},
+	{"diag","",CmdDiag,"sample rate, missed conversions and loop timing"},
+	// make sure this one is last
+	{NULL}
+};
+// tare and calibrate take a while, this keeps track of the one running
+enum eConsoleOperation { eConsoleIdle = 0, eConsoleTare, eConsoleSettle, eConsoleCalibrate };
+eConsoleOperation ConsoleOperation = eConsoleIdle;
+UiTask ConsoleTask;             // only the settling fields are used
+int nConsoleCalibrateGrams;
@@ -6,26 +6,28 @@
 
 /*
    -------------------------------------------------------------------------------------
-   HX711_ADC
-   Arduino library for HX711 24-Bit Analog-to-Digital Converter for Weight Scales
-   Olav Kallhovd sept2017
+   The load cell is read with the driver in HX711.h and LoadCell.h, which works like the HX711_ADC
+   library by Olav Kallhovd and keeps its units, so the saved calibration values are the same.
+   The acquisition task calls update() much more often than the HX711 sample rate, see AcquireTask().
    -------------------------------------------------------------------------------------
-   Settling time (number of samples) and data filtering can be adjusted in the config.h file
-   For calibration and storing the calibration value in eeprom, see example file "Calibration.ino"
-
-   The update() function checks for new data and starts the next conversion. In order to achieve maximum effective
-   sample rate, update() should be called at least as often as the HX711 sample rate; >10Hz@10SPS, >80Hz@80SPS.
-   If you have other time consuming code running (i.e. a graphical LCD), consider calling update() from an interrupt routine,
-   see example file "Read_1x_load_cell_interrupt_driven.ino".
 */
 #include "FilamentScale.h"
 
 void setup() {
+    // room for the binary stream frames so they don't block
+    Serial.setTxBufferSize(SERIAL_TX_BUFFER);
     Serial.begin(115200); delay(10);
     //Serial.println("Starting...");
+	BootMark("serial");
+	Profiler.begin();
+	// power up the HX711 first, it settles in the background while the display and settings are initialized
+	LoadCell.begin();
+	PumpLoadCellStart();
+	BootMark("hx711 power up");
 	CRotaryDialButton::begin(DIAL_A, DIAL_B, DIAL_BTN, GPIO_NUM_0, GPIO_NUM_35, (gpio_num_t)-1, (gpio_num_t)-1, &DialSettings);
 	DialSettings.m_bToggleDial = true;
 	tft.init();
+	PumpLoadCellStart();
     // configure LCD PWM functionalitites
     pinMode(TFT_ENABLE, OUTPUT);
     digitalWrite(TFT_ENABLE, 1);
@@ -35,148 +37,938 @@ void setup() {
     ledcWrite(ledChannel, 255);
     tft.fillScreen(TFT_BLACK);
     tft.setRotation(3);
-    tft.setFreeFont(&Dialog_bold_16);
+    tft.setFreeFont(pTextFont);
+	tft.setSwapBytes(true);
+	BigWeight.begin(&tft, &Dialog_bold_16, BIG_WEIGHT_SCALE);
+	// the graph goes between the top line and the bottom line
+	WeightGraph.setArea(&tft, tft.fontHeight(), 5 * tft.fontHeight());
+	PumpLoadCellStart();
+	BootMark("display");
 
 	menuPtr = new MenuInfo;
     MenuStack.push(menuPtr);
     MenuStack.top()->menu = MainMenu;
     MenuStack.top()->index = 0;
     MenuStack.top()->offset = 0;
-	// read the saved settings after checking the version
-	SaveLoadSettings(false, true);
+	// read the saved settings, this checks the version first
 	SaveLoadSettings(false);
-	// 0 can't be used, it will cause a calibration failure later
-	if (calibrationValue == 0.0)
-		calibrationValue = 400;
-	Serial.println("calval: " + String(calibrationValue));
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		// 0 can't be used, it will cause a calibration failure later
+		if (calibrationValue[ch] == 0.0)
+			calibrationValue[ch] = 400;
+		Serial.println("calval " + String(ch + 1) + ": " + String(calibrationValue[ch]));
+		// each load cell starts with the spool of the same number
+		if (nActiveSpool[ch] < 1 || nActiveSpool[ch] > MAX_SPOOLS)
+			nActiveSpool[ch] = ch + 1;
+		// the saved spool is taken to be the one on the load cell until another one is put on
+		bSpoolKnown[ch] = true;
+	}
+	nLoadCell = constrain(nLoadCell, 1, LOADCELL_CHANNELS);
 	SetLcdBrightness(nDisplayBrightness);
-	// a sanity check
-	if (calibrationValue > 5000 || calibrationValue < -200) {
-		DisplayLine(0, "suspicious calval: " + String(calibrationValue), TFT_RED);
-		delay(1000);
-	}
-    LoadCell.begin();
-    // tare precision can be improved by adding a few seconds of stabilizing time, 2000 in this case
-    LoadCell.start(2000, false);	// false means don't tare the scale on startup
-    if (LoadCell.getTareTimeoutFlag()) {
-		DisplayLine(0, "LoadCell Failed", TFT_RED);
-		delay(1000);
-		DisplayLine(2, "Timeout, check MCU>HX711", TFT_RED);
-		delay(2000);
-    }
-	else {
-        LoadCell.setCalFactor(calibrationValue); // set calibration factor (float)
-		LoadCell.update();
-		LoadCell.setTareOffset(tareOffset);
-		DisplayLine(0, "Startup complete", TFT_GREEN);
-		delay(1000);
-	}
-	int tries = 100;
-	while (bFoundLoadcell && !LoadCell.update()) {
-		if (tries-- <= 0) {
-			DisplayLine(0, "Loadcell not responding", TFT_RED);
-			delay(2000);
-			bFoundLoadcell = false;
-		}
-		delay(10);
+	// settings saved before there was a graph don't have this
+	if (nGraphMinutes < 5 || nGraphMinutes > 1440)
+		nGraphMinutes = 60;
+	WeightGraph.begin(nGraphMinutes * 60000UL);
+	PumpLoadCellStart();
+	BootMark("settings");
+	if (!WeightLog.begin()) {
+		ShowToast("Log file system failed", TFT_RED, 3000);
 	}
-	if (bFoundLoadcell) {
-		LoadCell.refreshDataSet();
-		Serial.print("Calibration value: ");
-		Serial.println(LoadCell.getCalFactor());
-		Serial.print("HX711 measured conversion time ms: ");
-		Serial.println(LoadCell.getConversionTime());
-		Serial.print("HX711 measured sampling rate HZ: ");
-		Serial.println(LoadCell.getSPS());
-		Serial.print("HX711 measured settlingtime ms: ");
-		Serial.println(LoadCell.getSettlingTime());
-		Serial.println("Note that the settling time may increase significantly if you use delay() in your sketch!");
-		if (LoadCell.getSPS() < 7) {
-			Serial.println("!!Sampling rate is lower than specification, check MCU>HX711 wiring and pin designations");
+	// the usage history and the spools are on the same file system
+	SpoolStats.load();
+	if (!SpoolDb.load()) {
+		SpoolDb.migrate(SpoolWeights, MAX_SPOOL_WEIGHTS, fullSpoolFilament, nLengthConversion);
+		SpoolDb.save();
+		// the migrated spools are all taken to be full, so auto would pick the wrong one until they have been weighed
+		if (nSpoolIdentify == 2) {
+			nSpoolIdentify = 1;
+			SaveLoadSettings(true);
 		}
-		else if ((int)LoadCell.getSPS() > 100) {
-			Serial.println("!!Sampling rate is higher than specification, check MCU>HX711 wiring and pin designations");
+	}
+	PumpLoadCellStart();
+	BootMark("log");
+	// a sanity check
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		if (calibrationValue[ch] > 5000 || calibrationValue[ch] < -200) {
+			ShowToast("suspicious calval " + String(ch + 1) + ": " + String(calibrationValue[ch]), TFT_RED, 3000);
 		}
 	}
+	// finish whatever is left of the HX711 stabilizing time, it has been running since LoadCell.begin()
+	while (!PumpLoadCellStart())
+		;
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		LoadCell[ch].setCalFactor(calibrationValue[ch]); // set calibration factor (float)
+		LoadCell[ch].setTareOffset(tareOffset[ch]);
+	}
+	LoadCell.setGain(LoadCellGains[nLoadCellGain]);
+	BootMark("hx711 stable");
+	// the first reading is shown by loop() as soon as the dataset is full, give up if nothing arrives
+	loadcellDeadline = millis() + LOADCELL_TIMEOUT_MS;
 	// clear the button buffer
 	CRotaryDialButton::clear();
-	// reset the usage counters
-	ResetUsage();
-	tft.fillScreen(TFT_BLACK);
+	// carry on with the usage rate from before a restart, it has to be in place before the acquisition task uses it
+	bool bUsageRestored = RestoreUsage();
+	// sampling runs on its own from here on
+	StartAcquisition();
+	// or reset the usage counters
+	if (!bUsageRestored)
+		ResetUsage();
+	bUsageCheckpoints = true;
+#ifdef TELEMETRY
+	SendTelemetrySettings();
+#endif
+	ClearScreen();
+	BootMark("setup done");
 }
 
 void loop() {
-	static bool bLastSettingsMode = true;
-	static boolean newDataReady = false;
-	static bool didsomething = false;
-	static int lastMinute = -1;
-	if (bSettingsMode) {
-		didsomething = HandleMenus();
+	CProfileScope profile(Profiler, eProfLoop);
+	int64_t loopStart = esp_timer_get_time();
+	if (lastLoopStart)
+		Profiler.addUs(eProfLoopPeriod, loopStart - lastLoopStart);
+	lastLoopStart = loopStart;
+	static unsigned long timeholder = 0;
+	// take the latest numbers from the acquisition task, they keep coming while the menus and wizards are up
+	unsigned long lastConversions = ScaleState.conversions;
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch)
+		PublishedState[ch].read(ScaleStates[ch]);
+	ScaleState = ScaleStates[CHANNEL_INDEX];
+	bool newDataReady = bFoundLoadcell && ScaleState.conversions != lastConversions;
+	// nothing else runs while it is idle, anything that needs it wakes it up first
+	ServiceIdle();
+	if (bIdle)
+		return;
+	if (newDataReady) {
+		RecordScaleState();
+		CheckpointUsage(false);
+		IdentifySpools();
+		AlertScaleEvents();
+	}
+	STREAMSAMPLE sample;
+	while (xQueueReceive(StreamSampleQueue, &sample, 0) == pdTRUE) {
+		StreamSample(sample);
+	}
+	ServiceSerial();
+	ServiceConsole();
+	ServiceStream();
+
+	// the first reading is shown as soon as the filter is full, don't wait for the display interval
+	bool bShowFirst = false;
+	if (!bFirstReading && bFoundLoadcell) {
+		if (newDataReady && ScaleState.bDataValid) {
+			bFirstReading = bShowFirst = true;
+		}
+		else if (millis() > loadcellDeadline) {
+			DisplayLine(0, "Loadcell not responding", TFT_RED);
+			DisplayLine(2, "Timeout, check MCU>HX711", TFT_RED);
+			bFoundLoadcell = false;
+			ShowBootTrace();
+		}
+	}
+
+	if (RunUiTask()) {
+		// a wizard or message owns the display
+	}
+	else if (bSettingsMode) {
+		HandleMenus();
 	}
 	else {
-		if (bLastSettingsMode) {
-			bLastSettingsMode = false;
+		if (bRedrawStatus) {
 			DisplayLine(6, "Long Press for Menu", TFT_BLUE);
 		}
 		if (CRotaryDialButton::getCount()) {
-			CRotaryDialButton::Button btn = CRotaryDialButton::dequeue();
+			CRotaryDialButton::Button btn = ReadButton();
 			if (btn == CRotaryDialButton::BTN_LONGPRESS) {
-				bLastSettingsMode = bSettingsMode = true;
+				bSettingsMode = true;
+			}
+			else if (btn == CRotaryDialButton::BTN_LEFT || btn == CRotaryDialButton::BTN_RIGHT) {
+				// switch between the numbers and the graph
+				bGraphScreen = !bGraphScreen;
+				ClearScreen();
+				bRedrawStatus = true;
 			}
 		}
+		if (!bSettingsMode && bFirstReading && (bShowFirst || bRedrawStatus || millis() > timeholder + (serialPrintInterval * 1000))) {
+			timeholder = millis();
+			ShowScaleState();
+		}
+		// the graph sends a column as soon as it has one
+		if (!bSettingsMode && bFirstReading && bGraphScreen && WeightGraph.draw()) {
+			ShowGraphScale();
+		}
+		bRedrawStatus = false;
 	}
+	CheckTimingAlarm();
+	ServiceToasts();
+	FinishInputTrace();
+	if (bShowFirst) {
+		BootMark("first reading");
+		ShowBootTrace();
+		ShowLoadCellInfo();
+	}
+}
 
-    // check for new data/start next conversion:
-	if (!bSettingsMode && bFoundLoadcell && LoadCell.update())
-		newDataReady = true;
+// start the acquisition task, the HX711 must not be touched from anywhere else after this
+void StartAcquisition()
+{
+	LoadCellRequests = xQueueCreate(4, sizeof(LOADCELLREQUEST));
+	StreamSampleQueue = xQueueCreate(STREAM_QUEUE_LENGTH, sizeof(STREAMSAMPLE));
+	// not running out until the first reading says so
+	digitalWrite(RUNOUT_PIN, bRunoutHigh ? LOW : HIGH);
+	pinMode(RUNOUT_PIN, OUTPUT_OPEN_DRAIN);
+	xTaskCreatePinnedToCore(AcquireTask, "acquire", ACQUIRE_STACK, NULL, ACQUIRE_PRIORITY, NULL, ACQUIRE_CORE);
+}
 
-	static unsigned long timeholder = 0;
-    // get smoothed value from the dataset:
-	if (!bSettingsMode && newDataReady) {
-		if (millis() > timeholder + (serialPrintInterval * 1000)) {
-			float weight = LoadCell.getData();
-			newDataReady = false;
-			timeholder = millis();
-			int filamentWeight = (int)((weight - SpoolWeights[SPOOL_INDEX]) + 0.5);
-			filamentWeight = constrain(filamentWeight, 0, filamentWeight);
-			int percent = (filamentWeight * 100 / fullSpoolFilament);
-            percent = constrain(percent, 0, 100);
-			DrawProgressBar(0, 0, tft.width() - 1, 12, percent);
-            String st;
-			st = "Spool " + String(nActiveSpool) + " @ " + String(percent) + "%";
-            DisplayLine(1, st);
-			st = "Weight: " + String(filamentWeight) + " g";
-			DisplayLine(2, st);
-			float length = filamentWeight * LENGTH_CONVERSION / 1000.0;
-			length = constrain(length, 0, length);
-			st = "Length: " + String(length) + " m";
-			DisplayLine(3, st);
-			// if the usage is 0, then it was reset, so we get the latest value
-			if (usageStartAmount == 0) {
-				usageStartAmount = filamentWeight;
+// ask the acquisition task to do something with the HX711, tares and calibrations are for nLoadCell
+void SendLoadCellRequest(eLoadCellRequest op, float grams = 0)
+{
+	LOADCELLREQUEST request = { op, CHANNEL_INDEX, grams };
+	xQueueSend(LoadCellRequests, &request, portMAX_DELAY);
+}
+
+// read the HX711s and publish the numbers for every conversion
+// the load cells share the clock, so each update() gets a conversion from all of them and they all keep the full rate
+void AcquireTask(void* arg)
+{
+	SCALESTATE state[LOADCELL_CHANNELS] = {};
+	bool bTaring[LOADCELL_CHANNELS] = {};
+	float lastWeight[LOADCELL_CHANNELS] = {};
+	int stableCount[LOADCELL_CHANNELS] = {};
+	float settledWeight[LOADCELL_CHANNELS] = {};
+	bool bSettled[LOADCELL_CHANNELS] = {};     // the first steady weight is what was there at boot, not a placement
+	bool bPoweredDown = false;
+	CFeedMonitor feed[LOADCELL_CHANNELS];
+	int runoutLevel = bRunoutHigh ? LOW : HIGH;
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		state[ch].calFactor = LoadCell[ch].getCalFactor();
+		state[ch].tareOffset = LoadCell[ch].getTareOffset();
+	}
+	// the acquisition numbers are worked out in the first one and copied to the others
+	SCALESTATE& acquire = state[0];
+	// the startup has been converting long enough for a first guess at the rate
+	acquire.detectedSps = DetectSps(LoadCell.getSPS());
+	TuneLoadCell(state);
+	// timing
+	int64_t lastUpdate = 0, lastConversion = 0;
+	int64_t windowStart = esp_timer_get_time();
+	unsigned long windowConversions = 0;
+	for (;;) {
+		bool bChanged = false;
+		LOADCELLREQUEST request;
+		while (xQueueReceive(LoadCellRequests, &request, 0) == pdTRUE) {
+			switch (request.op) {
+			case eRequestTare:
+				// update() does the tare
+				LoadCell[request.channel].tareNoDelay();
+				bTaring[request.channel] = true;
+				break;
+			case eRequestCalibrate:
+				state[request.channel].calFactor = LoadCell[request.channel].getNewCalibration(request.grams);
+				++state[request.channel].calibrateCount;
+				bChanged = true;
+				break;
+			case eRequestResetUsage:
+				for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+					feed[ch].reset();
+					time(&usageStartTime[ch]);
+					// the next reading is the start amount
+					usageStartAmount[ch] = 0;
+					bUsageCatchUp[ch] = false;
+				}
+				break;
+			case eRequestTune:
+				LoadCell.setGain(LoadCellGains[nLoadCellGain]);
+				for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+					LoadCell[ch].setCalFactor(calibrationValue[ch]);
+					LoadCell[ch].setTareOffset(tareOffset[ch]);
+					state[ch].calFactor = calibrationValue[ch];
+					state[ch].tareOffset = tareOffset[ch];
+				}
+				TuneLoadCell(state);
+				bChanged = true;
+				break;
+			case eRequestPowerDown:
+				LoadCell.powerDown();
+				bPoweredDown = acquire.bPoweredDown = true;
+				bChanged = true;
+				break;
+			case eRequestPowerUp:
+				LoadCell.powerUp();
+				bPoweredDown = acquire.bPoweredDown = false;
+				// the time asleep isn't a gap in the sampling
+				lastUpdate = lastConversion = 0;
+				windowStart = esp_timer_get_time();
+				windowConversions = 0;
+				bChanged = true;
+				break;
 			}
-			// calculate usage rate
-			time_t timeNow = time(NULL);
-			double elapsedTime = difftime(timeNow, usageStartTime);
-			int seconds = (int)round(elapsedTime);
-			if (seconds) {
-				double rate = (double)(usageStartAmount - filamentWeight) / seconds * 60.0;
-				rate = constrain(rate, 0, rate);
-				st = "Usage: " + String(rate, 1) + " g/Min";
-				DisplayLine(4, st);
-				// now get remaining time
-				if (rate > 0.0) {
-					double minutesLeft = filamentWeight / rate;
-					st = "Time Left: " + String((int)(minutesLeft / 60.0)) + ":" + String((int)minutesLeft % 60) + " H:M";
-					DisplayLine(5, st);
+		}
+		if (bPoweredDown) {
+			// there is nothing to read, the requests are still answered
+			if (bChanged) {
+				for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+					ShareAcquireState(acquire, state[ch]);
+					PublishedState[ch].write(state[ch]);
 				}
-				else
-				{
-					DisplayLine(5, "");
+			}
+			vTaskDelay(1);
+			continue;
+		}
+		int64_t now = esp_timer_get_time();
+		if (lastUpdate)
+			Profiler.addUs(eProfUpdateGap, now - lastUpdate);
+		lastUpdate = now;
+		bool bNewData;
+		{
+			CProfileScope profile(Profiler, eProfUpdate);
+			bNewData = LoadCell.update();
+		}
+		if (bNewData) {
+			const int64_t period = 1000000 / acquire.detectedSps;
+			float seconds = lastConversion ? (now - lastConversion) / 1000000.0f : 0;
+			// a gap of more than one and a half periods means the HX711 had another one ready that we missed
+			if (lastConversion && now - lastConversion > period * 3 / 2)
+				acquire.missedConversions += (now - lastConversion + period / 2) / period - 1;
+			lastConversion = now;
+			++windowConversions;
+			++acquire.conversions;
+			acquire.sps = LoadCell.getSPS();
+			// the rate is measured again all the time, in case the first guess was wrong
+			if (acquire.conversions >= SPS_DETECT_CONVERSIONS && DetectSps(acquire.sps) != acquire.detectedSps) {
+				acquire.detectedSps = DetectSps(acquire.sps);
+				TuneLoadCell(state);
+			}
+			for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+				state[ch].bDataValid = LoadCell[ch].getDataSetStatus();
+				if (state[ch].bDataValid) {
+					UpdateScaleState(state[ch], ch);
+					stableCount[ch] = fabs(state[ch].weight - lastWeight[ch]) <= ResponseProfiles[nResponseProfile].stableGrams ? stableCount[ch] + 1 : 0;
+					lastWeight[ch] = state[ch].weight;
+					state[ch].bStable = stableCount[ch] >= acquire.stableConversions;
+					// a step to a new steady weight is a spool being put on, using filament only moves it slowly
+					if (state[ch].bStable) {
+						if (bSettled[ch] && fabs(state[ch].weight - settledWeight[ch]) > SPOOL_STEP_GRAMS && state[ch].weight >= SPOOL_PRESENT_GRAMS) {
+							state[ch].placedWeight = state[ch].weight;
+							++state[ch].placements;
+							feed[ch].reset();
+						}
+						settledWeight[ch] = state[ch].weight;
+						bSettled[ch] = true;
+					}
+					state[ch].bRunout = CheckRunout(state[ch]);
+					// the feed is only watched while there is a spool on
+					if (state[ch].weight >= SPOOL_PRESENT_GRAMS)
+						feed[ch].add(state[ch].weight, LoadCell[ch].getRawData(), seconds);
+					else
+						feed[ch].reset();
+					state[ch].feedRate = feed[ch].rate();
+					state[ch].bFeedStalled = feed[ch].stalled();
+					state[ch].bFeedTension = feed[ch].tension();
 				}
 			}
+			// any load cell running out sets the pin, it is done here so it follows the conversion that crossed
+			bool bRunout = false;
+			for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch)
+				bRunout = bRunout || state[ch].bRunout || (bFeedAlarm && (state[ch].bFeedStalled || state[ch].bFeedTension));
+			int level = bRunout == bRunoutHigh ? HIGH : LOW;
+			if (level != runoutLevel) {
+				digitalWrite(RUNOUT_PIN, level);
+				runoutLevel = level;
+			}
+			if (nStreamSubscriptions & STREAM_SUB_SAMPLES) {
+				CLoadCellChannel& channel = LoadCell[CHANNEL_INDEX];
+				STREAMSAMPLE sample = { (uint32_t)micros(), (int32_t)channel.getRaw(), channel.getData() };
+				xQueueSend(StreamSampleQueue, &sample, 0);
+			}
+			bChanged = true;
+		}
+		for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+			if (bTaring[ch] && LoadCell[ch].getTareStatus()) {
+				bTaring[ch] = false;
+				state[ch].tareOffset = LoadCell[ch].getTareOffset();
+				++state[ch].tareCount;
+				bChanged = true;
+			}
+		}
+		if (now - windowStart >= DIAG_WINDOW_MS * 1000LL) {
+			acquire.achievedSps = windowConversions * 1000000.0f / (now - windowStart);
+			windowStart = now;
+			windowConversions = 0;
+			bChanged = true;
+		}
+		if (bChanged) {
+			for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+				ShareAcquireState(acquire, state[ch]);
+				PublishedState[ch].write(state[ch]);
+			}
+		}
+		// the HX711 is much slower than the tick
+		vTaskDelay(1);
+	}
+}
+
+// the runout alarm with hysteresis, it goes on at a threshold and off a bit above it
+// this runs in the acquisition task for every conversion, the thresholds are single words that the menus change
+bool CheckRunout(const SCALESTATE& state)
+{
+	bool bMinutes = state.bRateValid && state.minutesLeft >= 0;
+	if (!state.bRunout) {
+		return (nRunoutGrams && state.filamentWeight <= nRunoutGrams)
+			|| (nRunoutMinutes && bMinutes && state.minutesLeft <= nRunoutMinutes);
+	}
+	return (nRunoutGrams && state.filamentWeight <= nRunoutGrams + RUNOUT_HYSTERESIS_GRAMS)
+		|| (nRunoutMinutes && bMinutes && state.minutesLeft <= nRunoutMinutes + RUNOUT_HYSTERESIS_MINUTES);
+}
+
+// copy the numbers that are the same for all the load cells
+void ShareAcquireState(const SCALESTATE& from, SCALESTATE& to)
+{
+	to.conversions = from.conversions;
+	to.sps = from.sps;
+	to.missedConversions = from.missedConversions;
+	to.achievedSps = from.achievedSps;
+	to.detectedSps = from.detectedSps;
+	to.samplesInUse = from.samplesInUse;
+	to.stableConversions = from.stableConversions;
+	to.bPoweredDown = from.bPoweredDown;
+}
+
+// the RATE pin picks 10 or 80 SPS, the measured rate says which
+int DetectSps(float sps)
+{
+	if (sps <= 0)
+		return HX711_SPS;
+	return sps > SPS_DETECT_THRESHOLD ? 80 : 10;
+}
+
+// size the filters and the stability test for the rate and the response profile, this runs in the acquisition task
+void TuneLoadCell(SCALESTATE* state)
+{
+	const RESPONSEPROFILE& profile = ResponseProfiles[nResponseProfile];
+	// the filter is a power of two, so this rounds down
+	LoadCell.setSamplesInUse(state[0].detectedSps * profile.filterMs / 1000);
+	state[0].samplesInUse = LoadCell.getSamplesInUse();
+	state[0].stableConversions = max(2, state[0].detectedSps * profile.stableMs / 1000);
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		state[ch].bDataValid = LoadCell[ch].getDataSetStatus();
+		state[ch].bStable = false;
+	}
+}
+
+// calculate the status numbers from the smoothed weight, this runs in the acquisition task
+// the settings it uses are changed by the menus, each one is a single word so it is never seen half written
+void UpdateScaleState(SCALESTATE& state, int channel)
+{
+	float weight;
+	{
+		CProfileScope profile(Profiler, eProfGetData);
+		weight = LoadCell[channel].getData();
+	}
+	CProfileScope profile(Profiler, eProfMath);
+	const CSpoolDb::SPOOLRECORD& spool = SpoolDb.spool(nActiveSpool[channel]);
+	int filamentWeight = (int)((weight - spool.emptyGrams) + 0.5);
+	filamentWeight = constrain(filamentWeight, 0, filamentWeight);
+	int percent = (filamentWeight * 100 / spool.netGrams);
+	percent = constrain(percent, 0, 100);
+	// the conversion is meters per kg with 2 decimals
+	float length = filamentWeight * spool.lengthConversion / 100000.0;
+	length = constrain(length, 0, length);
+	state.weight = weight;
+	state.filamentWeight = filamentWeight;
+	state.percent = percent;
+	state.length = length;
+	// a file checkpoint can be minutes old, the filament used since then would count against the checkpoint's time
+	if (bUsageCatchUp[channel]) {
+		bUsageCatchUp[channel] = false;
+		if (usageStartAmount[channel])
+			usageStartAmount[channel] += filamentWeight - usageCheckpointAmount[channel];
+	}
+	// if the usage is 0, then it was reset, so we get the latest value
+	if (usageStartAmount[channel] == 0) {
+		usageStartAmount[channel] = filamentWeight;
+	}
+	// more filament than at the start is a different spool, the usage starts over from it
+	else if (filamentWeight > usageStartAmount[channel] + SPOOL_STEP_GRAMS) {
+		usageStartAmount[channel] = filamentWeight;
+		time(&usageStartTime[channel]);
+	}
+	// calculate usage rate
+	time_t timeNow = time(NULL);
+	double elapsedTime = difftime(timeNow, usageStartTime[channel]);
+	int seconds = (int)round(elapsedTime);
+	state.bRateValid = seconds != 0;
+	if (seconds) {
+		double rate = (double)(usageStartAmount[channel] - filamentWeight) / seconds * 60.0;
+		rate = constrain(rate, 0, rate);
+		state.rate = rate;
+		// now get remaining time
+		state.minutesLeft = rate > 0.0 ? filamentWeight / rate : -1;
+	}
+}
+
+// feed a new reading to the graph, the log, and the usage history
+// the graph and the log follow nLoadCell, the log keeps which one each sample is from, the usage history has every spool that is on a load cell
+// only load cells with a full dataset are trusted
+void RecordScaleState()
+{
+	CProfileScope profile(Profiler, eProfRecord);
+	if (ScaleState.bDataValid) {
+		WeightGraph.add(millis(), ScaleState.filamentWeight);
+		WeightLog.add(time(NULL), lround(ScaleState.weight * 10), nLoadCell);
+	}
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		if (ScaleStates[ch].bDataValid)
+			SpoolStats.add(ch, time(NULL), nActiveSpool[ch], lround((ScaleStates[ch].weight - SpoolDb.spool(nActiveSpool[ch]).emptyGrams) * 10));
+		// keep what is left on the spool for identifying it next time, once the same spool has been
+		// stable for a while, not while it is being put on or taken off or another one is being picked
+		if (bSpoolKnown[ch] && ScaleStates[ch].bStable && ScaleStates[ch].weight >= SPOOL_PRESENT_GRAMS) {
+			if (spoolStableTime[ch] == 0 || spoolStableSpool[ch] != nActiveSpool[ch]) {
+				spoolStableTime[ch] = max(millis(), 1UL);
+				spoolStableSpool[ch] = nActiveSpool[ch];
+			}
+			else if (millis() - spoolStableTime[ch] >= SPOOL_REMAINING_MS)
+				SpoolDb.setRemaining(nActiveSpool[ch], ScaleStates[ch].filamentWeight);
+		}
+		else {
+			spoolStableTime[ch] = 0;
+		}
+	}
+}
+
+// keep the usage numbers for after a restart, RTC memory every time and the file now and then
+void CheckpointUsage(bool bFile)
+{
+	if (!bUsageCheckpoints)
+		return;
+	USAGECHECKPOINT checkpoint;
+	memset(&checkpoint, 0, sizeof(checkpoint));
+	checkpoint.magic = USAGE_MAGIC;
+	time_t now = time(NULL);
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		checkpoint.elapsed[ch] = max((time_t)0, now - usageStartTime[ch]);
+		checkpoint.startAmount[ch] = usageStartAmount[ch];
+		checkpoint.amount[ch] = ScaleStates[ch].bDataValid ? ScaleStates[ch].filamentWeight : -1;
+		checkpoint.spool[ch] = nActiveSpool[ch];
+	}
+	checkpoint.crc = CStreamFrame::Crc16((uint8_t*)&checkpoint, sizeof(checkpoint) - sizeof(checkpoint.crc));
+	RtcUsage = checkpoint;
+	if (bFile || millis() - usageFileTime >= USAGE_CHECKPOINT_MINUTES * 60000UL) {
+		usageFileTime = millis();
+		File file = LittleFS.open(USAGE_FILE, "w");
+		if (file) {
+			file.write((uint8_t*)&checkpoint, sizeof(checkpoint));
+			file.close();
+		}
+	}
+}
+
+// put the usage numbers back from RTC memory, or the file if the power went, returns true if any were
+// a load cell that has a different spool than it did starts over
+bool RestoreUsage()
+{
+	USAGECHECKPOINT checkpoint = RtcUsage;
+	String from = "RTC";
+	if (!IsUsageValid(checkpoint)) {
+		from = "file";
+		File file = LittleFS.open(USAGE_FILE, "r");
+		if (!file)
+			return false;
+		bool ok = file.read((uint8_t*)&checkpoint, sizeof(checkpoint)) == sizeof(checkpoint);
+		file.close();
+		if (!ok || !IsUsageValid(checkpoint))
+			return false;
+	}
+	time_t now = time(NULL);
+	bool bRestored = false;
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		usageStartTime[ch] = now;
+		usageStartAmount[ch] = 0;
+		if (checkpoint.spool[ch] != nActiveSpool[ch])
+			continue;
+		usageStartTime[ch] = now - checkpoint.elapsed[ch];
+		usageStartAmount[ch] = checkpoint.startAmount[ch];
+		usageCheckpointAmount[ch] = checkpoint.amount[ch];
+		bUsageCatchUp[ch] = checkpoint.amount[ch] >= 0;
+		bRestored = true;
+	}
+	if (bRestored)
+		Serial.println("usage restored from " + from + ", " + String(checkpoint.elapsed[CHANNEL_INDEX] / 60) + " Min");
+	return bRestored;
+}
+
+bool IsUsageValid(const USAGECHECKPOINT& checkpoint)
+{
+	return checkpoint.magic == USAGE_MAGIC && checkpoint.crc == CStreamFrame::Crc16((const uint8_t*)&checkpoint, sizeof(checkpoint) - sizeof(checkpoint.crc));
+}
+
+// the pin has already been set by the acquisition task, this tells whoever is looking and the stream
+void AlertScaleEvents()
+{
+	static bool bRunout[LOADCELL_CHANNELS], bStalled[LOADCELL_CHANNELS], bTension[LOADCELL_CHANNELS];
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		const SCALESTATE& state = ScaleStates[ch];
+		String spool = "Spool " + String(nActiveSpool[ch]);
+		if (state.bRunout != bRunout[ch]) {
+			bRunout[ch] = state.bRunout;
+			StreamEvent(ch, STREAM_EVENT_RUNOUT, state.bRunout, state.filamentWeight);
+			if (state.bRunout)
+				ShowToast(spool + " running out: " + String(state.filamentWeight) + " g", TFT_RED, 5000);
+			else
+				ShowToast(spool + " runout cleared", TFT_GREEN);
+		}
+		if (state.bFeedStalled != bStalled[ch]) {
+			bStalled[ch] = state.bFeedStalled;
+			StreamEvent(ch, STREAM_EVENT_STALL, state.bFeedStalled, state.feedRate);
+			if (state.bFeedStalled)
+				ShowToast(spool + " feed stopped, tangle?", TFT_RED, 5000);
+		}
+		if (state.bFeedTension != bTension[ch]) {
+			bTension[ch] = state.bFeedTension;
+			StreamEvent(ch, STREAM_EVENT_TENSION, state.bFeedTension, state.feedRate);
+			if (state.bFeedTension)
+				ShowToast(spool + " pulled hard, tangle?", TFT_RED, 5000);
+		}
+	}
+}
+
+// look for the spool that was put on a load cell, by what each spool should weigh
+// auto picks the closest if nothing else is near, otherwise the candidates are shown to pick from
+// wizards and console operations put things on the scale too, so nothing happens while one is running
+void IdentifySpools()
+{
+	static unsigned long placements[LOADCELL_CHANNELS];
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		if (ScaleStates[ch].placements == placements[ch])
+			continue;
+		placements[ch] = ScaleStates[ch].placements;
+		if (nSpoolIdentify == 0 || !UiTaskStack.empty() || ConsoleOperation != eConsoleIdle)
+			continue;
+		float grams = ScaleStates[ch].placedWeight;
+		nSpoolMatches = SpoolDb.match(grams, SPOOL_MATCH_GRAMS, SpoolMatches, SPOOL_MATCH_MAX);
+		if (nSpoolMatches == 0) {
+			bSpoolKnown[ch] = false;
+			ShowToast("No spool matches " + String(lround(grams)) + " g", TFT_YELLOW, 3000);
+			continue;
+		}
+		if (nSpoolIdentify == 2 && (nSpoolMatches == 1 || SpoolMatches[1].error - SpoolMatches[0].error >= SPOOL_MATCH_MARGIN)) {
+			SelectSpool(ch, SpoolMatches[0].spool);
+			continue;
+		}
+		bSpoolKnown[ch] = false;
+		nIdentifyChannel = ch;
+		identifyGrams = grams;
+		StartUiTask(IdentifySpoolTask);
+		// one at a time, the others are looked at again when it is done
+		break;
+	}
+}
+
+// make a spool the one on a load cell
+void SelectSpool(int channel, int spool)
+{
+	// the last weight of the old one is saved in case the power goes before the next save
+	if (nActiveSpool[channel] != spool)
+		SpoolDb.flush();
+	nActiveSpool[channel] = spool;
+	bSpoolKnown[channel] = true;
+	bMenuChanged = true;
+	bRedrawStatus = true;
+	ShowToast((LOADCELL_CHANNELS > 1 ? "Load Cell " + String(channel + 1) + ": Spool " : String("Spool ")) + String(spool));
+}
+
+// pick from the spools in SpoolMatches, turn for the next one, click to use it, long press to leave it as it was
+bool IdentifySpoolTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	switch (task->step) {
+	case 0:
+		nIdentifyChoice = 0;
+		ClearScreen();
+		DisplayLine(0, (LOADCELL_CHANNELS > 1 ? "Load Cell " + String(nIdentifyChannel + 1) + ": " : String("Spool on: ")) + String(lround(identifyGrams)) + " g");
+		ClickContinue("Click to use, long to skip");
+		task->lastValue = -1;
+		++task->step;
+		break;
+	case 1:
+		if (btn == BTN_SELECT) {
+			SelectSpool(nIdentifyChannel, SpoolMatches[nIdentifyChoice].spool);
+			return true;
+		}
+		if (btn == BTN_LONG) {
+			// the spool stays as it was and is trusted again
+			bSpoolKnown[nIdentifyChannel] = true;
+			return true;
+		}
+		if (btn == BTN_LEFT)
+			nIdentifyChoice = (nIdentifyChoice + nSpoolMatches - 1) % nSpoolMatches;
+		else if (btn == BTN_RIGHT)
+			nIdentifyChoice = (nIdentifyChoice + 1) % nSpoolMatches;
+		if (nIdentifyChoice == task->lastValue)
+			break;
+		task->lastValue = nIdentifyChoice;
+		ShowSpoolMatches(1);
+		break;
+	}
+	return false;
+}
+
+// the candidates in SpoolMatches from a display line down, nIdentifyChoice is marked
+void ShowSpoolMatches(int line)
+{
+	for (int ix = 0; ix < nSpoolMatches; ++ix) {
+		const CSpoolDb::SPOOLRECORD& spool = SpoolDb.spool(SpoolMatches[ix].spool);
+		DisplayLine(line + ix, String(ix == nIdentifyChoice ? ">" : " ") + "Spool " + String(SpoolMatches[ix].spool) + ": "
+			+ String(spool.remainingGrams) + " g, " + String(SpoolMatches[ix].error) + " off",
+			ix == nIdentifyChoice ? menuLineActiveColor : menuLineColor);
+	}
+}
+
+// weigh spools one after another, each one is matched as it is put on and recorded, then the next one goes on
+// the fast response profile is used while it runs, a gram or so doesn't matter here and it saves a second a spool
+void TakeInventory(MenuItem* menu)
+{
+	StartUiTask(InventoryTask, menu);
+}
+
+bool InventoryTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	// task->conversions has the placements that have been handled
+	if (btn == BTN_LONG) {
+		nResponseProfile = task->originalValue;
+		SendLoadCellRequest(eRequestTune);
+		// the last spool weighed is on the scale, not the active one
+		bSpoolKnown[CHANNEL_INDEX] = nSpoolIdentify == 0;
+		ShowToast(String(nInventoryItems) + " spools in the inventory");
+		return true;
+	}
+	switch (task->step) {
+	case 0:
+		task->originalValue = nResponseProfile;
+		nResponseProfile = 2;
+		SendLoadCellRequest(eRequestTune);
+		bSpoolKnown[CHANNEL_INDEX] = false;
+		task->conversions = ScaleState.placements;
+		ClearScreen();
+		DisplayLine(0, "Inventory: " + String(nInventoryItems) + " spools");
+		ClickContinue("Long Press to Finish");
+		// a spool that is already on has been counted
+		if (ScaleState.weight >= SPOOL_PRESENT_GRAMS) {
+			DisplayLine(2, "Take the spool off");
+			task->step = 3;
+		}
+		else {
+			DisplayLine(2, "Put a spool on");
+			task->step = 1;
+		}
+		break;
+	case 1:
+		// wait for a spool to go on
+		if (ScaleState.placements == task->conversions)
+			break;
+		task->conversions = ScaleState.placements;
+		identifyGrams = ScaleState.placedWeight;
+		nSpoolMatches = SpoolDb.match(identifyGrams, SPOOL_MATCH_GRAMS, SpoolMatches, SPOOL_MATCH_MAX);
+		if (nSpoolMatches == 0) {
+			AddInventoryItem(NewInventorySpool(identifyGrams), true, identifyGrams);
+			task->step = 3;
+		}
+		else if (nSpoolMatches == 1 || SpoolMatches[1].error - SpoolMatches[0].error >= SPOOL_MATCH_MARGIN) {
+			AddInventoryItem(SpoolMatches[0].spool, false, identifyGrams);
+			task->step = 3;
+		}
+		else {
+			// too close to call, turn to pick one
+			nIdentifyChoice = 0;
+			ShowSpoolMatches(1);
+			DisplayLine(5, "Click to use it");
+			task->step = 2;
+		}
+		break;
+	case 2:
+		if (btn == BTN_LEFT || btn == BTN_RIGHT) {
+			nIdentifyChoice = (nIdentifyChoice + (btn == BTN_LEFT ? nSpoolMatches - 1 : 1)) % nSpoolMatches;
+			ShowSpoolMatches(1);
 		}
-    }
+		else if (btn == BTN_SELECT) {
+			for (int line = 1; line <= 5; ++line)
+				DisplayLine(line, "");
+			AddInventoryItem(SpoolMatches[nIdentifyChoice].spool, false, identifyGrams);
+			task->step = 3;
+		}
+		break;
+	case 3:
+		// wait for it to come off, or for the next one if it was swapped without the scale settling empty
+		if ((ScaleState.bDataValid && ScaleState.weight < SPOOL_PRESENT_GRAMS) || ScaleState.placements != task->conversions) {
+			DisplayLine(2, "Put a spool on");
+			task->step = 1;
+		}
+		break;
+	}
+	return false;
+}
+
+// a spool that didn't match gets the first free number, it is taken to be full so the empty weight is what is left
+// 0 if it is too light for that or there isn't a free one
+int NewInventorySpool(float grams)
+{
+	for (int spool = 1; spool <= MAX_SPOOLS; ++spool) {
+		if (SpoolDb.spool(spool).emptyGrams != 0)
+			continue;
+		int emptyGrams = lround(grams) - SpoolDb.spool(spool).netGrams;
+		if (emptyGrams < SPOOL_PRESENT_GRAMS)
+			return 0;
+		SpoolDb.setEmpty(spool, emptyGrams);
+		return spool;
+	}
+	return 0;
+}
+
+// record a weighed spool, weighing the same one again replaces it
+void AddInventoryItem(int spool, bool bNew, float grams)
+{
+	INVENTORYITEM item = { time(NULL), spool, bNew, 0, 0, grams };
+	if (spool) {
+		const CSpoolDb::SPOOLRECORD& record = SpoolDb.spool(spool);
+		item.filamentWeight = max(0, (int)lround(grams) - record.emptyGrams);
+		item.length = item.filamentWeight * record.lengthConversion / 100000.0;
+		SpoolDb.setRemaining(spool, item.filamentWeight);
+	}
+	int ix = 0;
+	while (ix < nInventoryItems && (spool == 0 || InventoryItems[ix].spool != spool))
+		++ix;
+	if (ix == MAX_INVENTORY) {
+		ShowToast("Inventory is full", TFT_RED);
+		return;
+	}
+	InventoryItems[ix] = item;
+	if (ix == nInventoryItems)
+		++nInventoryItems;
+	DisplayLine(0, "Inventory: " + String(nInventoryItems) + " spools");
+	if (spool)
+		DisplayLine(1, String(bNew ? "New " : "") + "Spool " + String(spool) + ": " + String(item.filamentWeight) + " g " + String(item.length, 1) + " m");
+	else
+		DisplayLine(1, "Unknown: " + String(lround(grams)) + " g", TFT_YELLOW);
+	DisplayLine(2, "Take the spool off");
+}
+
+// show the status numbers
+void ShowScaleState()
+{
+	CProfileScope profile(Profiler, eProfShowState);
+	if (bGraphScreen) {
+		DisplayLine(0, "Spool " + String(nActiveSpool[CHANNEL_INDEX]) + ": " + String(ScaleState.filamentWeight) + " g");
+		ShowGraphScale();
+		return;
+	}
+	if (LOADCELL_CHANNELS > 1) {
+		ShowAllScaleStates();
+		return;
+	}
+	DrawProgressBar(0, 0, tft.width() - 1, 12, ScaleState.percent);
+	String st;
+	String timeLeft;
+	if (ScaleState.bRateValid && ScaleState.minutesLeft >= 0.0) {
+		double minutesLeft = ScaleState.minutesLeft;
+		timeLeft = String((int)(minutesLeft / 60.0)) + ":" + String((int)minutesLeft % 60);
+	}
+	if (bBigWeight) {
+		// the big weight covers lines 2 to 4, so the length goes with the spool and the time with the rate
+		st = "Spool " + String(nActiveSpool[CHANNEL_INDEX]) + " @ " + String(ScaleState.percent) + "% " + String(ScaleState.length, 1) + " m";
+		DisplayLine(1, st);
+		BigWeight.draw(2 * tft.fontHeight() + (3 * tft.fontHeight() - BigWeight.height()) / 2, (String(ScaleState.filamentWeight) + "g").c_str());
+		if (ScaleState.bRateValid) {
+			st = String(ScaleState.rate, 1) + " g/Min";
+			if (timeLeft.length())
+				st += "  " + timeLeft + " H:M";
+			DisplayLine(5, st);
+		}
+		return;
+	}
+	st = "Spool " + String(nActiveSpool[CHANNEL_INDEX]) + " @ " + String(ScaleState.percent) + "%";
+	DisplayLine(1, st);
+	st = "Weight: " + String(ScaleState.filamentWeight) + " g";
+	DisplayLine(2, st);
+	st = "Length: " + String(ScaleState.length) + " m";
+	DisplayLine(3, st);
+	if (ScaleState.bRateValid) {
+		st = "Usage: " + String(ScaleState.rate, 1) + " g/Min";
+		DisplayLine(4, st);
+		if (timeLeft.length()) {
+			st = "Time Left: " + timeLeft + " H:M";
+			DisplayLine(5, st);
+		}
+		else
+		{
+			DisplayLine(5, "");
+		}
+	}
+}
+
+// a line for each load cell, the one the menus are for is marked
+void ShowAllScaleStates()
+{
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+		const SCALESTATE& state = ScaleStates[ch];
+		String st = String(ch == CHANNEL_INDEX ? ">" : " ") + String(ch + 1) + " S" + String(nActiveSpool[ch]);
+		if (state.bDataValid) {
+			st += " " + String(state.percent) + "% " + String(state.filamentWeight) + "g";
+			if (state.bRateValid)
+				st += " " + String(state.rate, 1) + "g/M";
+		}
+		DisplayLine(ch, st);
+	}
+}
+
+// the bottom line of the graph screen shows the weights and time it covers
+void ShowGraphScale()
+{
+	DisplayLine(6, String(WeightGraph.low()) + "-" + String(WeightGraph.high()) + " g, " + String(WeightGraph.spanMinutes()) + " Min", TFT_BLUE);
+}
+
+// keep the HX711 converting during startup, returns true when the stabilizing time is over
+bool PumpLoadCellStart()
+{
+	return LoadCell.startMultiple(LOADCELL_STABILIZE_MS, false) != 0;
+}
+
+// record the end of a startup phase
+void BootMark(const char* phase)
+{
+	if (nBootPhases < MAX_BOOT_PHASES) {
+		BootTrace[nBootPhases].name = phase;
+		BootTrace[nBootPhases].ms = millis();
+		++nBootPhases;
+	}
+}
+
+// print the startup phases with the time each one ended and how long it took
+void ShowBootTrace()
+{
+	unsigned long last = 0;
+	Serial.println("Boot trace (ms since reset, phase length):");
+	for (int ix = 0; ix < nBootPhases; ++ix) {
+		Serial.printf("%6lu %5lu  %s\n", BootTrace[ix].ms, BootTrace[ix].ms - last, BootTrace[ix].name);
+		last = BootTrace[ix].ms;
+	}
+}
+
+// show the HX711 numbers, these are only meaningful after some conversions have been done
+void ShowLoadCellInfo()
+{
+	Serial.print("Calibration value: ");
+	Serial.println(ScaleState.calFactor);
+	Serial.print("HX711 measured conversion time ms: ");
+	Serial.println(LoadCell.getConversionTime());
+	Serial.print("HX711 measured sampling rate HZ: ");
+	Serial.println(ScaleState.sps);
+	Serial.print("HX711 measured settlingtime ms: ");
+	Serial.println(LoadCell.getSettlingTime());
+	Serial.println("Note that the settling time may increase significantly if you use delay() in your sketch!");
+	if (ScaleState.sps < 7) {
+		Serial.println("!!Sampling rate is lower than specification, check MCU>HX711 wiring and pin designations");
+	}
+	else if ((int)ScaleState.sps > 100) {
+		Serial.println("!!Sampling rate is higher than specification, check MCU>HX711 wiring and pin designations");
+	}
 }
 
 // set LCD brighntess, 0 to 100
@@ -187,118 +979,576 @@ void SetLcdBrightness(uint b)
 	ledcWrite(ledChannel, bright);
 }
 
-CRotaryDialButton::Button ClickContinue(char* text=NULL)
+// go idle when nothing has happened for a while, and run the weighings while it is
+// printing, a moving weight, an alarm, a menu, a wizard, or a stream subscriber all keep it awake
+void ServiceIdle()
+{
+	if (!bIdle) {
+		for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+			const SCALESTATE& state = ScaleStates[ch];
+			if (!state.bStable || state.feedRate >= FEED_MIN_RATE || state.bRunout || state.bFeedStalled || state.bFeedTension)
+				lastActivityTime = millis();
+		}
+		if (nIdleMinutes && bFirstReading && !bSettingsMode && UiTaskStack.empty() && ConsoleOperation == eConsoleIdle
+			&& !nStreamSubscriptions && !bTelemetryOn && millis() - lastActivityTime >= nIdleMinutes * 60000UL)
+			EnterIdle();
+		return;
+	}
+	// the dial, a button, or the serial port while it is weighing or waiting for the HX711 to power down, nothing else reads them
+	if (CRotaryDialButton::getCount() || Serial.available()) {
+		LeaveIdle();
+		return;
+	}
+	if (bIdleBurst) {
+		// the weighing is done when the dataset has filled after the power up
+		if (ScaleState.conversions < idleBurstConversions && millis() - idleBurstStart < IDLE_BURST_TIMEOUT_MS)
+			return;
+		for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+			if (ScaleStates[ch].bDataValid && fabs(ScaleStates[ch].weight - IdleWeights[ch]) > IDLE_WAKE_GRAMS) {
+				LeaveIdle();
+				return;
+			}
+		}
+		SendLoadCellRequest(eRequestPowerDown);
+		bIdleBurst = false;
+	}
+	// the HX711 has to be off before the sleep
+	if (!ScaleState.bPoweredDown)
+		return;
+	if (IdleSleep() != ESP_SLEEP_WAKEUP_TIMER) {
+		LeaveIdle();
+		return;
+	}
+	// time for a weighing, it runs from loop() like the others until the dataset is full
+	SendLoadCellRequest(eRequestPowerUp);
+	bIdleBurst = true;
+	idleBurstStart = millis();
+	idleBurstConversions = ScaleState.conversions + LOADCELL_POWERUP_SKIP + ScaleState.samplesInUse + DATASET_EXTRA_SAMPLES;
+}
+
+void EnterIdle()
+{
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch)
+		IdleWeights[ch] = ScaleStates[ch].weight;
+	// the usage history, the spools, and the usage rate are saved first in case the power goes while it sleeps
+	SpoolStats.flush();
+	SpoolDb.flush();
+	CheckpointUsage(true);
+	SendLoadCellRequest(eRequestPowerDown);
+	// the LEDC stops in light sleep, so the backlight is off rather than dimmed
+	SetLcdBrightness(0);
+	bIdle = true;
+	bIdleBurst = false;
+}
+
+void LeaveIdle()
+{
+	if (!bIdleBurst)
+		SendLoadCellRequest(eRequestPowerUp);
+	bIdle = bIdleBurst = false;
+	lastActivityTime = millis();
+	SetLcdBrightness(nDisplayBrightness);
+	// the button that woke it up isn't for the menus
+	CRotaryDialButton::clear();
+	ClearScreen();
+	bRedrawStatus = true;
+	bMenuChanged = true;
+}
+
+// light sleep until the next weighing, or the dial, a button, or the serial port, returns why it woke
+esp_sleep_wakeup_cause_t IdleSleep()
+{
+	// the UART stops while it sleeps
+	Serial.flush();
+	for (gpio_num_t pin : IdleButtonPins)
+		gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+	for (gpio_num_t pin : IdleDialPins)
+		gpio_wakeup_enable(pin, gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+	esp_sleep_enable_gpio_wakeup();
+	uart_set_wakeup_threshold(UART_NUM_0, IDLE_UART_EDGES);
+	esp_sleep_enable_uart_wakeup(0);
+	esp_sleep_enable_timer_wakeup(IDLE_SAMPLE_SECONDS * 1000000ULL);
+	esp_light_sleep_start();
+	for (gpio_num_t pin : IdleDialPins)
+		gpio_wakeup_disable(pin);
+	for (gpio_num_t pin : IdleButtonPins) {
+		gpio_wakeup_disable(pin);
+		gpio_set_intr_type(pin, GPIO_INTR_NEGEDGE);
+	}
+	lastLoopStart = 0;
+	return esp_sleep_get_wakeup_cause();
+}
+
+#ifdef TELEMETRY
+// hand the settings to the telemetry task, it is started the first time there is a network to join
+void SendTelemetrySettings()
+{
+	if (!TelemetryTaskHandle && !*WifiSsid)
+		return;
+	TELEMETRYSETTINGS settings;
+	strcpy(settings.ssid, WifiSsid);
+	strcpy(settings.password, WifiPassword);
+	strcpy(settings.host, MqttHost);
+	settings.port = nMqttPort;
+	if (!TelemetryTaskHandle) {
+		TelemetrySettingsQueue = xQueueCreate(1, sizeof(TELEMETRYSETTINGS));
+		bTelemetryOn = true;
+		xTaskCreatePinnedToCore(TelemetryTask, "telemetry", TELEMETRY_STACK, NULL, TELEMETRY_PRIORITY, &TelemetryTaskHandle, TELEMETRY_CORE);
+	}
+	xQueueOverwrite(TelemetrySettingsQueue, &settings);
+}
+
+// join the network, keep the broker connection up, and send the state of each load cell when it changes enough
+// a new conversion count in the published state is a new sample, a poll that finds the same one only checks the timers
+// nothing is sent when no one is listening, and a new listener gets the state straight away
+void TelemetryTask(void* arg)
+{
+	TELEMETRYSETTINGS settings;
+	xQueueReceive(TelemetrySettingsQueue, &settings, portMAX_DELAY);
+	WiFi.mode(WIFI_STA);
+	WiFi.begin(settings.ssid, settings.password);
+	uint8_t mac[6];
+	WiFi.macAddress(mac);
+	char id[8];
+	snprintf(id, sizeof(id), "%02x%02x%02x", mac[3], mac[4], mac[5]);
+	String prefix = String(TELEMETRY_TOPIC) + "/" + id + "/";
+	String clientId = String(TELEMETRY_TOPIC) + "-" + id;
+	WiFiClient socket;
+	CMqttClient<WiFiClient> mqtt(socket);
+	WiFiServer server(TELEMETRY_WS_PORT);
+	CWebSocketServer<WiFiServer, WiFiClient> webSocket(server);
+	bool bServer = false;
+	unsigned long lastConnect = millis() - TELEMETRY_RETRY_MS;
+	CTelemetryChannel channels[LOADCELL_CHANNELS];
+	unsigned long conversions[LOADCELL_CHANNELS] = {};
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch)
+		channels[ch].begin(ch + 1);
+	char payload[TELEMETRY_MAX_PAYLOAD];
+	auto send = [&](int ch, const char* kind, int length, bool retain, uint32_t ms) {
+		mqtt.publish((prefix + (ch + 1) + "/" + kind).c_str(), payload, length, retain, ms);
+		webSocket.send(payload, length);
+		++nTelemetrySent;
+	};
+	bool bWasListening = false;
+	for (;;) {
+		uint32_t ms = millis();
+		if (xQueueReceive(TelemetrySettingsQueue, &settings, 0) == pdTRUE) {
+			mqtt.stop();
+			WiFi.disconnect();
+			// without a network the radio goes off and it waits for one, it can go idle meanwhile
+			while (!*settings.ssid) {
+				WiFi.disconnect(true);
+				bTelemetryOn = false;
+				bMqttConnected = false;
+				nWebSocketClients = 0;
+				xQueueReceive(TelemetrySettingsQueue, &settings, portMAX_DELAY);
+			}
+			bTelemetryOn = true;
+			WiFi.begin(settings.ssid, settings.password);
+			lastConnect = millis() - TELEMETRY_RETRY_MS;
+		}
+		if (WiFi.status() == WL_CONNECTED) {
+			if (!bServer) {
+				server.begin();
+				bServer = true;
+			}
+			// the TCP connect waits, but only this task
+			if (mqtt.state() == CMqttClient<WiFiClient>::DISCONNECTED && *settings.host && ms - lastConnect >= TELEMETRY_RETRY_MS) {
+				lastConnect = ms;
+				if (socket.connect(settings.host, settings.port))
+					mqtt.begin(clientId.c_str(), ms);
+			}
+		}
+		mqtt.service(ms);
+		if (bServer)
+			webSocket.service(ms);
+		bMqttConnected = mqtt.connected();
+		int clients = webSocket.clients();
+		bool bListening = bMqttConnected || clients;
+		bool bNewListener = bListening && (!bWasListening || clients > nWebSocketClients);
+		bWasListening = bListening;
+		nWebSocketClients = clients;
+		for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+			SCALESTATE state;
+			PublishedState[ch].read(state);
+			bool bNewConversion = state.conversions != conversions[ch];
+			conversions[ch] = state.conversions;
+			if (!bListening || !state.bDataValid)
+				continue;
+			CTelemetryChannel& channel = channels[ch];
+			if (bNewListener)
+				channel.resend();
+			// the weights only go out while it is moving, the rest of the batch goes when it settles
+			if ((bNewConversion && !state.bStable && channel.addSample(state.weight, ms)) || channel.samplesDue(ms) || (state.bStable && channel.samples()))
+				send(ch, "samples", channel.formatSamples(payload, sizeof(payload)), false, ms);
+			TELEMETRYSTATE telemetry = {
+				state.weight, state.filamentWeight, state.percent, state.length,
+				state.bRateValid ? (float)state.rate : 0.0f, state.bRateValid ? (int)state.minutesLeft : -1, state.bStable,
+				(uint8_t)((state.bRunout ? TELEMETRY_ALARM_RUNOUT : 0) | (state.bFeedStalled ? TELEMETRY_ALARM_STALL : 0) | (state.bFeedTension ? TELEMETRY_ALARM_TENSION : 0))
+			};
+			// retained, so a dashboard that subscribes later gets the last state from the broker
+			if (channel.stateDue(telemetry, ms))
+				send(ch, "state", channel.formatState(telemetry, ms, payload, sizeof(payload)), true, ms);
+			else if (bNewConversion)
+				++nTelemetryCoalesced;
+		}
+		vTaskDelay(pdMS_TO_TICKS(TELEMETRY_POLL_MS));
+	}
+}
+#endif
+
+// show the click prompt, the task step after this waits for any button
+void ClickContinue(const char* text=NULL)
 {
 	DisplayLine(6, text == NULL ? "Click to Continue" : text, TFT_BLUE);
-	return CRotaryDialButton::waitButton(false, -1);
+}
+
+// start a UI task, loop() runs it until it finishes
+// tasks started by another task run first and the starting task continues when they are done,
+// so a task must not return true from the same step that starts another one
+void StartUiTask(UiTaskFunction function, MenuItem* menu)
+{
+	UiTask task = {};
+	task.function = function;
+	task.menu = menu;
+	UiTaskStack.push(task);
+}
+
+// run a step of the active UI task, returns false if there isn't one
+bool RunUiTask()
+{
+	if (UiTaskStack.empty())
+		return false;
+	// references to the top stay valid if the task starts another one
+	UiTask& task = UiTaskStack.top();
+	if ((*task.function)(&task, ReadButton())) {
+		UiTaskStack.pop();
+		if (UiTaskStack.empty()) {
+			// back to whatever was showing before
+			bMenuChanged = true;
+			if (!bSettingsMode) {
+				ClearScreen();
+				bRedrawStatus = true;
+			}
+		}
+	}
+	return true;
+}
+
+// start waiting for a dataset full of new conversions, like refreshDataSet() but without blocking
+void StartSettling(UiTask* task)
+{
+	task->timer = millis() + 500;
+	task->conversions = ScaleState.conversions + LoadCell.getSamplesInUse() + DATASET_EXTRA_SAMPLES;
+}
+
+// true when the weight on the scale has settled since StartSettling()
+bool IsSettled(UiTask* task)
+{
+	return millis() >= task->timer && ScaleState.conversions >= task->conversions;
+}
+
+// ask for a tare, IsTareDone() says when it has finished
+void StartTare(UiTask* task)
+{
+	task->lastValue = ScaleState.tareCount;
+	SendLoadCellRequest(eRequestTare);
+}
+
+// true when the tare from StartTare() is done, tareOffset has the new value
+bool IsTareDone(UiTask* task)
+{
+	if (ScaleState.tareCount == (unsigned long)task->lastValue)
+		return false;
+	tareOffset[CHANNEL_INDEX] = ScaleState.tareOffset;
+	return true;
+}
+
+// ask for a calibration with the known mass on the scale, IsCalibrationDone() says when it has finished
+void StartCalibration(UiTask* task, int grams)
+{
+	task->lastValue = ScaleState.calibrateCount;
+	SendLoadCellRequest(eRequestCalibrate, (float)grams);
+}
+
+// true when the calibration is done, calibrationValue has the new value
+bool IsCalibrationDone(UiTask* task)
+{
+	if (ScaleState.calibrateCount == (unsigned long)task->lastValue)
+		return false;
+	calibrationValue[CHANNEL_INDEX] = ScaleState.calFactor;
+	return true;
 }
 
 // zero the scale
 void SetTare(MenuItem* menu)
 {
-	tft.fillScreen(TFT_BLACK);
-	DisplayLine(0, "Remove Spool");
-	DisplayLine(1, "Replace Nut");
-	ClickContinue();
-	tft.fillScreen(TFT_BLACK);
-	DisplayLine(0, "Setting Scale to Zero");
-	LoadCell.update();
-	LoadCell.tare();
-	// get the value so we can save it
-	tareOffset = LoadCell.getTareOffset();
-	DisplayLine(0, "Scale has been zeroed");
-	ClickContinue();
+	StartUiTask(SetTareTask, menu);
+}
+
+bool SetTareTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	switch (task->step) {
+	case 0:
+		ClearScreen();
+		DisplayLine(0, "Remove Spool");
+		DisplayLine(1, "Replace Nut");
+		ClickContinue();
+		++task->step;
+		break;
+	case 1:
+		if (btn == BTN_NONE)
+			break;
+		ClearScreen();
+		DisplayLine(0, "Setting Scale to Zero");
+		StartTare(task);
+		++task->step;
+		break;
+	case 2:
+		// this gets the value so we can save it
+		if (!IsTareDone(task))
+			break;
+		DisplayLine(0, "Scale has been zeroed");
+		ClickContinue();
+		++task->step;
+		break;
+	default:
+		return btn != BTN_NONE;
+	}
+	return false;
 }
 
 // reset the usage numbers
 void ResetUsage(MenuItem* menu)
 {
-	// set the start time
-	time(&usageStartTime);
-	// clear the usage
-	usageStartAmount = 0;
-	tft.fillScreen(TFT_BLACK);
+	// the acquisition task owns the usage numbers
+	SendLoadCellRequest(eRequestResetUsage);
+	ClearScreen();
 	if (menu) {
-		DisplayLine(0, "Usage Rate Reset");
-		delay(1000);
+		ShowToast("Usage Rate Reset");
 	}
 }
 
-void SetMenuDisplayWeight(MenuItem* menu, int flag)
+// the spool fields are edited in SpoolEdit, it is filled from the active spool before they are shown
+// and the one that changed is written back when it is done
+void SetMenuSpoolField(MenuItem* menu, int flag)
 {
-	// TODO: should probably check for eText or eTextInt here
 	if (flag == -2) {
-		menu->value = &SpoolWeights[SPOOL_INDEX];
+		const CSpoolDb::SPOOLRECORD& spool = SpoolDb.spool(ACTIVE_SPOOL);
+		SpoolEdit.emptyGrams = spool.emptyGrams;
+		SpoolEdit.netGrams = spool.netGrams;
+		SpoolEdit.density = spool.density;
+		SpoolEdit.diameter = spool.diameter;
+	}
+	else if (flag == -1) {
+		if (menu->value == &SpoolEdit.emptyGrams)
+			SpoolDb.setEmpty(ACTIVE_SPOOL, SpoolEdit.emptyGrams);
+		else if (menu->value == &SpoolEdit.netGrams)
+			SpoolDb.setNet(ACTIVE_SPOOL, SpoolEdit.netGrams);
+		else
+			SpoolDb.setMaterial(ACTIVE_SPOOL, SpoolEdit.density, SpoolEdit.diameter);
 	}
 }
 
+// while it is being edited the value is the editor's copy
 void SetMenuDisplayBrightness(MenuItem* menu, int flag)
 {
-	SetLcdBrightness(nDisplayBrightness);
+	if (flag != -2) {
+		SetLcdBrightness(*(int*)menu->value);
+	}
+}
+
+// each load cell has its own spool, one that is picked by hand is the one on it
+void SetMenuActiveSpool(MenuItem* menu, int flag)
+{
+	if (flag == -2) {
+		menu->value = &nActiveSpool[CHANNEL_INDEX];
+	}
+	else if (flag == -1) {
+		bSpoolKnown[CHANNEL_INDEX] = true;
+	}
+}
+
+// without identification the active spool is always taken to be the one on the load cell
+void SetMenuSpoolIdentify(MenuItem* menu, int flag)
+{
+	if (flag == -1 && nSpoolIdentify == 0) {
+		for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch)
+			bSpoolKnown[ch] = true;
+	}
 }
 
-void ChangeSpoolWeight(MenuItem* menu)
+// the graph and the log are for one load cell, so the graph starts over
+void SetMenuLoadCell(MenuItem* menu, int flag)
 {
-	// add the address and get the integer
-	menu->value = &SpoolWeights[SPOOL_INDEX];
-	GetIntegerValue(menu);
+	if (flag == -1) {
+		WeightGraph.begin(nGraphMinutes * 60000UL);
+	}
+}
+
+// the column times change, so the graph starts over
+void SetMenuGraphMinutes(MenuItem* menu, int flag)
+{
+	if (flag == -1) {
+		WeightGraph.begin(nGraphMinutes * 60000UL);
+	}
+}
+
+// the gains on channel A are a factor of two apart, so the calibration is scaled to match
+// channel B is a different input and has to be tared and calibrated again
+void SetMenuLoadCellGain(MenuItem* menu, int flag)
+{
+	static int oldGain;
+	if (flag == 1) {
+		oldGain = nLoadCellGain;
+	}
+	else if (flag == -1 && nLoadCellGain != oldGain) {
+		const int gains[] = { 128, 64, 32 };
+		if (LoadCellGains[oldGain] != HX711_GAIN_B32 && LoadCellGains[nLoadCellGain] != HX711_GAIN_B32) {
+			float ratio = (float)gains[nLoadCellGain] / gains[oldGain];
+			for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch) {
+				calibrationValue[ch] *= ratio;
+				tareOffset[ch] = 0x800000 + lround((tareOffset[ch] - 0x800000) * ratio);
+			}
+		}
+		else {
+			ShowToast("Tare and calibrate the new input", TFT_YELLOW, 3000);
+		}
+		SendLoadCellRequest(eRequestTune);
+	}
+}
+
+void SetMenuResponseProfile(MenuItem* menu, int flag)
+{
+	if (flag == -1) {
+		SendLoadCellRequest(eRequestTune);
+	}
 }
 
 // weight an actual empty spool
 void WeighEmptySpool(MenuItem* menu)
 {
-	tft.fillScreen(TFT_BLACK);
-	DisplayLine(0, "Remove spool");
-	ClickContinue();
-	DisplayLine(0, "Setting Tare...");
-	LoadCell.update();
-	LoadCell.tare();
-	DisplayLine(0, "Tare Complete");
-	tareOffset = LoadCell.getTareOffset();
-	delay(500);
-	DisplayLine(0, "Load Empty Spool");
-	ClickContinue();
-	DisplayLine(0, "Weighing...");
-	LoadCell.update();
-	delay(500);
-	LoadCell.refreshDataSet(); //refresh the dataset to be sure that the known mass is measured correct
-	float emptyWeight = LoadCell.getData();
-	SpoolWeights[SPOOL_INDEX] = emptyWeight;
-	DisplayLine(0, "Spool Weight: " + String(SpoolWeights[SPOOL_INDEX]));
-	ClickContinue();
+	StartUiTask(WeighEmptySpoolTask, menu);
 }
 
+bool WeighEmptySpoolTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	switch (task->step) {
+	case 0:
+		ClearScreen();
+		DisplayLine(0, "Remove spool");
+		ClickContinue();
+		++task->step;
+		break;
+	case 1:
+		if (btn == BTN_NONE)
+			break;
+		DisplayLine(0, "Setting Tare...");
+		StartTare(task);
+		++task->step;
+		break;
+	case 2:
+		if (!IsTareDone(task))
+			break;
+		DisplayLine(0, "Tare Complete");
+		task->timer = millis() + 500;
+		++task->step;
+		break;
+	case 3:
+		if (millis() < task->timer)
+			break;
+		DisplayLine(0, "Load Empty Spool");
+		ClickContinue();
+		++task->step;
+		break;
+	case 4:
+		if (btn == BTN_NONE)
+			break;
+		DisplayLine(0, "Weighing...");
+		// make sure the dataset only has the new weight in it
+		StartSettling(task);
+		++task->step;
+		break;
+	case 5:
+		if (!IsSettled(task))
+			break;
+		SpoolDb.setEmpty(ACTIVE_SPOOL, lround(ScaleState.weight));
+		DisplayLine(0, "Spool Weight: " + String(SpoolDb.spool(ACTIVE_SPOOL).emptyGrams));
+		ClickContinue();
+		++task->step;
+		break;
+	default:
+		return btn != BTN_NONE;
+	}
+	return false;
+}
+
+// calculate the spool weight by using a full spool and entering the known filament weight
+/*
+1. Load Spool
+2. Enter known filament weight in grams
+3. Spool weight = measured weight - filament weight
+4. Save spool weight in current spool
+5. Save to eeprom?
+*/
+int nFullSpoolGrams = 1200;
+MenuItem FullSpoolWeightMenu = { eTextInt, "Enter Total Grams: %d", GetIntegerValue, &nFullSpoolGrams, 1, 2000 };
+
 void CalculateSpoolWeight(MenuItem* menu)
 {
-	// calculate the spool weight by using a full spool and entering the known filament weight
-	/*
-	1. Load Spool
-	2. Enter known filament weight in grams
-	3. Spool weight = measured weight - filament weight
-	4. Save spool weight in current spool
-	5. Save to eeprom?
-	*/
-	int weight = 1200;
-	MenuItem weightMenu = { eTextInt, "Enter Total Grams: %d", GetIntegerValue, &weight, 1, 2000 };
-	DisplayLine(0, "Load New Spool");
-	ClickContinue();
-	GetIntegerValue(&weightMenu);
-	tft.fillScreen(TFT_BLACK);
-	LoadCell.update();
-	delay(500);
-	LoadCell.refreshDataSet(); //refresh the dataset to be sure that the known mass is measured correct
-	float totalWeight = LoadCell.getData();
-	SpoolWeights[SPOOL_INDEX] = totalWeight - weight;
-	DisplayLine(0, "Spool Weight: " + String(SpoolWeights[SPOOL_INDEX]));
-	ClickContinue();
+	StartUiTask(CalculateSpoolWeightTask, menu);
+}
+
+bool CalculateSpoolWeightTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	switch (task->step) {
+	case 0:
+		DisplayLine(0, "Load New Spool");
+		ClickContinue();
+		++task->step;
+		break;
+	case 1:
+		if (btn == BTN_NONE)
+			break;
+		GetIntegerValue(&FullSpoolWeightMenu);
+		++task->step;
+		break;
+	case 2:
+		// the weight has been entered
+		ClearScreen();
+		StartSettling(task);
+		++task->step;
+		break;
+	case 3:
+		if (!IsSettled(task))
+			break;
+		SpoolDb.setEmpty(ACTIVE_SPOOL, lround(ScaleState.weight) - nFullSpoolGrams);
+		DisplayLine(0, "Spool Weight: " + String(SpoolDb.spool(ACTIVE_SPOOL).emptyGrams));
+		ClickContinue();
+		++task->step;
+		break;
+	default:
+		return btn != BTN_NONE;
+	}
+	return false;
 }
 
 // read or store values in EEPROM
 bool SaveLoadSettings(bool save, bool bOnlySignature)
 {
-	EEPROM.begin(1024);
+	EEPROM.begin(SETTINGS_EEPROM_SIZE);
 	bool retvalue = true;
 	int blockpointer = 0;
+	// how much of the list was saved
+	uint32_t savedLength = 0;
+	if (!save) {
+		EEPROM.readBytes(SETTINGS_LENGTH_ADDRESS, &savedLength, sizeof(savedLength));
+		uint32_t firstLength = 0;
+		for (int ix = 0; ix < SETTINGS_FIRST_VALUES; ++ix)
+			firstLength += saveValueList[ix].size;
+		if (savedLength < firstLength || savedLength > SETTINGS_LENGTH_ADDRESS)
+			savedLength = firstLength;
+	}
 	for (int ix = 0; ix < (sizeof(saveValueList) / sizeof(*saveValueList)); blockpointer += saveValueList[ix++].size) {
 		if (save) {
 			size_t written;
@@ -314,35 +1564,63 @@ bool SaveLoadSettings(bool save, bool bOnlySignature)
 				memset(svalue, 0, sizeof(svalue));
 				size_t bytesread = EEPROM.readBytes(0, svalue, sizeof(VersionString));
 				if (strcmp(svalue, VersionString)) {
-					DisplayLine(0, "fixing bad eeprom version...", TFT_RED);
-					delay(1000);
+					ShowToast("fixing bad eeprom version...", TFT_RED);
 					return SaveLoadSettings(true);
 				}
 				if (bOnlySignature) {
 					return true;
 				}
 			}
-			else {
+			else if (blockpointer + saveValueList[ix].size <= savedLength) {
 				EEPROM.readBytes(blockpointer, saveValueList[ix].val, saveValueList[ix].size);
 			}
 		}
 	}
 	if (save) {
+		if (!bOnlySignature) {
+			uint32_t length = blockpointer;
+			EEPROM.writeBytes(SETTINGS_LENGTH_ADDRESS, &length, sizeof(length));
+		}
 		retvalue = EEPROM.commit();
+		// a good time to get the log, usage history, and spools up to date too
+		WeightLog.flush();
+		SpoolStats.flush();
+		SpoolDb.flush();
+		CheckpointUsage(true);
 	}
 	else {
+		// settings saved before these were added have whatever was in the EEPROM
+		// a bool is one byte, anything but 0 or 1 wasn't saved as one
+		if (*(uint8_t*)&bBigWeight > 1)
+			bBigWeight = true;
+		if (*(uint8_t*)&bRunoutHigh > 1)
+			bRunoutHigh = false;
+		if (*(uint8_t*)&bFeedAlarm > 1)
+			bFeedAlarm = false;
+		if (nLoadCellGain < 0 || nLoadCellGain > 2)
+			nLoadCellGain = 0;
+		if (nResponseProfile < 0 || nResponseProfile > 2)
+			nResponseProfile = 1;
+		if (nSpoolIdentify < 0 || nSpoolIdentify > 2)
+			nSpoolIdentify = 2;
+		if (nRunoutGrams < 0 || nRunoutGrams > 1000 || nRunoutMinutes < 0 || nRunoutMinutes > 600)
+			nRunoutGrams = nRunoutMinutes = 0;
+		if (nIdleMinutes < 0 || nIdleMinutes > 120)
+			nIdleMinutes = 15;
+		if (nMqttPort < 1 || nMqttPort > 65535) {
+			nMqttPort = 1883;
+			*WifiSsid = *WifiPassword = *MqttHost = '\0';
+		}
+		WifiSsid[sizeof(WifiSsid) - 1] = WifiPassword[sizeof(WifiPassword) - 1] = MqttHost[sizeof(MqttHost) - 1] = '\0';
 	}
-	DisplayLine(0, String(save ? "Settings Saved" : "Settings Loaded"));
+	ShowToast(save ? "Settings Saved" : "Settings Loaded");
 	return retvalue;
 }
 
 // save the array of weights and the current spool to the eeprom
 void SaveSpoolSettings(MenuItem* menu)
 {
-	tft.fillScreen(TFT_BLACK);
 	SaveLoadSettings(true);
-	DisplayLine(0, "Settings Saved");
-	delay(1000);
 }
 
 // save the array of weights and the current spool to the eeprom
@@ -352,37 +1630,76 @@ void LoadSpoolSettings(MenuItem* menu)
 }
 
 // calibrate the scale using a known weight
+int nCalibrateGrams = 1000;
+MenuItem CalibrateWeightMenu = { eTextInt, "Enter Grams: %d", GetIntegerValue, &nCalibrateGrams, 1, 2000 };
+
 void Calibrate(MenuItem* menu)
 {
-	int weight = 1000;
-	MenuItem weightMenu = { eTextInt, "Enter Grams: %d", GetIntegerValue, &weight, 1, 2000 };
-	tft.fillScreen(TFT_BLACK);
-	DisplayLine(0, "Remove spool");
-	ClickContinue();
-
-	boolean _resume = false;
-	DisplayLine(0, "Setting Tare...");
-	LoadCell.update();
-	LoadCell.tare();
-	DisplayLine(0, "Tare Complete");
-	tareOffset = LoadCell.getTareOffset();
-	delay(500);
-	DisplayLine(0, "Load Known Weight");
-	ClickContinue();
-
-	float known_mass = 0.0;
-	// read the value here
-	GetIntegerValue(&weightMenu);
-	tft.fillScreen(TFT_BLACK);
-	known_mass = (float)weight;
-	DisplayLine(0, "Calibrating Wt: " + String(known_mass));
-	// get the cell reading and add to dataset
-	LoadCell.update();
-	delay(500);
-	LoadCell.refreshDataSet(); //refresh the dataset to be sure that the known mass is measured correct
-	calibrationValue = LoadCell.getNewCalibration(known_mass); //get the new calibration value
-	DisplayLine(0, "New Calibration: " + String(calibrationValue));
-	ClickContinue();
+	StartUiTask(CalibrateTask, menu);
+}
+
+bool CalibrateTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	switch (task->step) {
+	case 0:
+		ClearScreen();
+		DisplayLine(0, "Remove spool");
+		ClickContinue();
+		++task->step;
+		break;
+	case 1:
+		if (btn == BTN_NONE)
+			break;
+		DisplayLine(0, "Setting Tare...");
+		StartTare(task);
+		++task->step;
+		break;
+	case 2:
+		if (!IsTareDone(task))
+			break;
+		DisplayLine(0, "Tare Complete");
+		task->timer = millis() + 500;
+		++task->step;
+		break;
+	case 3:
+		if (millis() < task->timer)
+			break;
+		DisplayLine(0, "Load Known Weight");
+		ClickContinue();
+		++task->step;
+		break;
+	case 4:
+		if (btn == BTN_NONE)
+			break;
+		// read the value here
+		GetIntegerValue(&CalibrateWeightMenu);
+		++task->step;
+		break;
+	case 5:
+		ClearScreen();
+		DisplayLine(0, "Calibrating Wt: " + String((float)nCalibrateGrams));
+		// get the cell readings for the known mass into the dataset
+		StartSettling(task);
+		++task->step;
+		break;
+	case 6:
+		if (!IsSettled(task))
+			break;
+		// get the new calibration value
+		StartCalibration(task, nCalibrateGrams);
+		++task->step;
+		break;
+	case 7:
+		if (!IsCalibrationDone(task))
+			break;
+		DisplayLine(0, "New Calibration: " + String(calibrationValue[CHANNEL_INDEX]));
+		ClickContinue();
+		++task->step;
+		break;
+	default:
+		return btn != BTN_NONE;
+	}
+	return false;
 }
 
 // draw a progress bar
@@ -397,41 +1714,61 @@ void DrawProgressBar(int x, int y, int dx, int dy, int percent)
 	tft.fillRect(x + 1 + fill, y + 1, dx - 2 - fill, dy - 2, TFT_BLACK);
 }
 
+// the pixels a character moves the cursor, straight from the font tables
+int GlyphAdvance(const GFXfont* font, char c)
+{
+	if ((uint8_t)c < font->first || (uint8_t)c > font->last)
+		return 0;
+	return pgm_read_byte(&font->glyph[(uint8_t)c - font->first].xAdvance);
+}
+
+// the pixels a character covers when it is the last one on a line, this is what textWidth() uses for the last one
+int GlyphExtent(const GFXfont* font, char c)
+{
+	if ((uint8_t)c < font->first || (uint8_t)c > font->last)
+		return 0;
+	const GFXglyph* glyph = &font->glyph[(uint8_t)c - font->first];
+	return (int8_t)pgm_read_byte(&glyph->xOffset) + pgm_read_byte(&glyph->width);
+}
+
 // insert newlines into a string so it doesn't wrap in the middle of words when displayed
 // existing newlines are honored
+// this is one pass, the line width is kept by adding up the glyph advances and the
+// space where the line breaks is turned into the newline, so nothing is measured twice
 String FormatMultiLine(String& input)
 {
 	String output;
-	int lineWidth = 0;
-	int lastInputSpace = 0;
-	int lastOutputSpace = 0;
-	int lastOutputStart = 0;
-	// look for spaces and add words to the output, when each line is too long start a new line
+	output.reserve(input.length());
+	int maxWidth = tft.width();
+	int lineWidth = 0;          // advance of everything on this line so far
+	int lastOutputSpace = -1;   // the last space on this line, -1 if none
+	int widthToSpace = 0;       // line width up to and including that space
 	for (int inIx = 0; inIx < input.length(); ++inIx) {
-		switch (input[inIx]) {
+		char ch = input[inIx];
+		switch (ch) {
 		case '\n':
 			// flush the line
-			output += '\n';
-			lastOutputStart = output.length();
+			output += ch;
+			lineWidth = 0;
+			lastOutputSpace = -1;
 			break;
 		case ' ':
-			output += input[inIx];
-			// mark the space location so we can go back
-			lastInputSpace = inIx;
-			lastOutputSpace = output.length();
+			output += ch;
+			// mark the space location so we can break there
+			lastOutputSpace = output.length() - 1;
+			lineWidth += GlyphAdvance(pTextFont, ch);
+			widthToSpace = lineWidth;
 			break;
 		default:
-			// check the width after adding this character
-			output += input[inIx];
-			lineWidth = tft.textWidth(output.substring(lastOutputStart));
-			if (lineWidth > tft.width()) {
-				// too wide, backup
-				output = output.substring(0, lastOutputSpace);
-				// add a newline to the output
-				output += '\n';
-				inIx = lastInputSpace;
-				lastOutputStart = output.length();
+			// check the width with this character on the end
+			if (lastOutputSpace >= 0 && lineWidth + GlyphExtent(pTextFont, ch) > maxWidth) {
+				// too wide, the space becomes the newline and this word starts the next line
+				output.setCharAt(lastOutputSpace, '\n');
+				lineWidth -= widthToSpace;
+				lastOutputSpace = -1;
 			}
+			output += ch;
+			lineWidth += GlyphAdvance(pTextFont, ch);
 			break;
 		}
 	}
@@ -441,12 +1778,24 @@ String FormatMultiLine(String& input)
 void ClearScreen()
 {
 	tft.fillScreen(TFT_BLACK);
+	bInputDrawn = true;
 	//ResetTextLines();
+	BigWeight.invalidate();
+	WeightGraph.invalidate();
+	// the toast line is empty now, put the toast back if one is showing
+	toastLineText = "";
+	bToastRedraw = true;
 }
 
 // display message on first line, if wait is -1, wait for a key press
+// the waiting is done by a UI task so this returns right away, one line timed messages are shown as toasts
 void WriteMessage(String txt, bool error, int wait, bool process)
 {
+	// short timed messages don't need the whole screen
+	if (wait > 0 && !process && txt.indexOf('\n') == -1) {
+		ShowToast(error ? "**" + txt + "**" : txt, error ? TFT_RED : menuLineColor, wait);
+		return;
+	}
 	ClearScreen();
 	if (process) {
 		txt = FormatMultiLine(txt);
@@ -461,15 +1810,41 @@ void WriteMessage(String txt, bool error, int wait, bool process)
 	tft.setCursor(0, tft.fontHeight());
 	tft.setTextWrap(true);
 	tft.print(txt);
-	if (wait == -1) {
-		// wait for a key
-		while (ReadButton() == BTN_NONE)
-			delay(10);
+	tft.setTextColor(TFT_WHITE);
+	if (wait) {
+		StartUiTask(WaitMessageTask);
+		UiTaskStack.top().wait = wait;
 	}
-	else {
-		delay(wait);
+}
+
+// keep a message showing until a key is pressed or the time is up
+bool WaitMessageTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	if (task->step == 0) {
+		task->timer = millis() + task->wait;
+		++task->step;
 	}
-	tft.setTextColor(TFT_WHITE);
+	if (task->wait == -1)
+		return btn != BTN_NONE;
+	return millis() >= task->timer;
+}
+
+// show the reboot message for a while and then restart
+bool RebootTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	if (task->step == 0) {
+		WriteMessage("Rebooting in 2 seconds\nHold button for factory reset", false, 0);
+		task->timer = millis() + 2000;
+		++task->step;
+	}
+	else if (millis() >= task->timer) {
+		WeightLog.flush();
+		SpoolStats.flush();
+		SpoolDb.flush();
+		CheckpointUsage(true);
+		ESP.restart();
+	}
+	return false;
 }
 
 // do something from the menu depending on the button argument
@@ -511,17 +1886,21 @@ void RunMenus(int button)
 				//case eTextCurrentFile:
 				case eBool:
 				case eList:
+				{
 					bMenuChanged = true;
-					if (MenuStack.top()->menu[ix].change != NULL) {
+					// the integer editor is a UI task that runs after this returns, it makes the calls itself
+					bool bCallChange = MenuStack.top()->menu[ix].change != NULL && MenuStack.top()->menu[ix].function != GetIntegerValue;
+					if (bCallChange) {
 						(*MenuStack.top()->menu[ix].change)(&MenuStack.top()->menu[ix], 1);
 					}
 					if (MenuStack.top()->menu[ix].function) {
 						(*MenuStack.top()->menu[ix].function)(&MenuStack.top()->menu[ix]);
 					}
-					if (MenuStack.top()->menu[ix].change != NULL) {
+					if (bCallChange) {
 						(*MenuStack.top()->menu[ix].change)(&MenuStack.top()->menu[ix], -1);
 					}
 					break;
+				}
 				//case eMacroList:
 				//	bMenuChanged = true;
 				//	if (MenuStack.top()->menu[ix].change != NULL) {
@@ -576,8 +1955,7 @@ void RunMenus(int button)
 					bExit = true;
 					break;
 				case eReboot:
-					WriteMessage("Rebooting in 2 seconds\nHold button for factory reset", false, 2000);
-					ESP.restart();
+					StartUiTask(RebootTask);
 					break;
 				}
 			}
@@ -600,6 +1978,7 @@ void RunMenus(int button)
 // remember that we only have room for nMenuLineCount lines
 void ShowMenu(struct MenuItem* menu)
 {
+	CProfileScope profile(Profiler, eProfShowMenu);
 	MenuStack.top()->menucount = 0;
 	int y = 0;
 	int x = 0;
@@ -657,6 +2036,10 @@ void ShowMenu(struct MenuItem* menu)
 		line[0] = '\0';
 		int val;
 		bool exists = false;
+		// let the item point its value at the right load cell or spool
+		if (menu->change != NULL) {
+			(*menu->change)(menu, -2);
+		}
 		switch (menu->op) {
 		case eTextInt:
 		case eText:
@@ -785,76 +2168,94 @@ void ToggleBool(MenuItem* menu)
 	}
 }
 
+// step to the next choice in a list, the menu max is the last one
+void NextListItem(MenuItem* menu)
+{
+	int* pValue = (int*)menu->value;
+	*pValue = *pValue >= menu->max ? menu->min : *pValue + 1;
+}
+
 // get integer values
 void GetIntegerValue(MenuItem* menu)
 {
-	if (menu->change != NULL) {
-		(*menu->change)(menu, 1);
-	}
-	// -1 means to reset to original
-	int stepSize = 1;
-	int originalValue = *(int*)menu->value;
+	StartUiTask(GetIntegerValueTask, menu);
+}
+
+bool GetIntegerValueTask(UiTask* task, CRotaryDialButton::Button button)
+{
+	MenuItem* menu = task->menu;
+	int* pValue = &task->value;
 	char line[50];
-	CRotaryDialButton::Button button = BTN_NONE;
-	bool done = false;
-	tft.fillScreen(TFT_BLACK);
-	const char* fmt = menu->decimals ? "%ld.%ld" : "%ld";
-	char minstr[20], maxstr[20];
-	sprintf(minstr, fmt, menu->min / (int)pow10(menu->decimals), menu->min % (int)pow10(menu->decimals));
-	sprintf(maxstr, fmt, menu->max / (int)pow10(menu->decimals), menu->max % (int)pow10(menu->decimals));
-	DisplayLine(1, String("Range: ") + String(minstr) + " to " + String(maxstr));
-	DisplayLine(3, "Long Press to Accept");
-	int oldVal = *(int*)menu->value;
-	do {
-		switch (button) {
-		case BTN_LEFT:
-			if (stepSize != -1)
-				*(int*)menu->value -= stepSize;
-			break;
-		case BTN_RIGHT:
-			if (stepSize != -1)
-				*(int*)menu->value += stepSize;
-			break;
-		case BTN_SELECT:
-			if (stepSize == -1) {
-				stepSize = 1;
-			}
-			else {
-				stepSize *= 10;
-			}
-			if (stepSize > (menu->max / 10)) {
-				stepSize = -1;
-			}
-			break;
-		case BTN_LONG:
-			if (stepSize == -1) {
-				*(int*)menu->value = originalValue;
-				stepSize = 1;
-			}
-			else {
-				done = true;
+	if (task->step == 0) {
+		if (menu->change != NULL) {
+			(*menu->change)(menu, 1);
+		}
+		// -1 means to reset to original
+		task->stepSize = 1;
+		task->value = task->originalValue = task->lastValue = *(int*)menu->value;
+		ClearScreen();
+		const char* fmt = menu->decimals ? "%ld.%ld" : "%ld";
+		char minstr[20], maxstr[20];
+		sprintf(minstr, fmt, menu->min / (int)pow10(menu->decimals), menu->min % (int)pow10(menu->decimals));
+		sprintf(maxstr, fmt, menu->max / (int)pow10(menu->decimals), menu->max % (int)pow10(menu->decimals));
+		DisplayLine(1, String("Range: ") + String(minstr) + " to " + String(maxstr));
+		DisplayLine(3, "Long Press to Accept");
+		++task->step;
+	}
+	else if (button == BTN_NONE) {
+		return false;
+	}
+	switch (button) {
+	case BTN_LEFT:
+		if (task->stepSize != -1)
+			*pValue -= task->stepSize;
+		break;
+	case BTN_RIGHT:
+		if (task->stepSize != -1)
+			*pValue += task->stepSize;
+		break;
+	case BTN_SELECT:
+		if (task->stepSize == -1) {
+			task->stepSize = 1;
+		}
+		else {
+			task->stepSize *= 10;
+		}
+		if (task->stepSize > (menu->max / 10)) {
+			task->stepSize = -1;
+		}
+		break;
+	case BTN_LONG:
+		if (task->stepSize == -1) {
+			*pValue = task->originalValue;
+			task->stepSize = 1;
+		}
+		else {
+			*(int*)menu->value = task->value;
+			if (menu->change != NULL) {
+				(*menu->change)(menu, -1);
 			}
-			break;
+			return true;
 		}
-		// make sure within limits
-		*(int*)menu->value = constrain(*(int*)menu->value, menu->min, menu->max);
-		// show slider bar
-		tft.fillRect(0, 2 * tft.fontHeight(), tft.width() - 1, 6, TFT_BLACK);
-		DrawProgressBar(0, 2 * tft.fontHeight() + 5, tft.width() - 1, 6, map(*(int*)menu->value, menu->min, menu->max, 0, 100));
-		sprintf(line, menu->text, *(int*)menu->value / (int)pow10(menu->decimals), *(int*)menu->value % (int)pow10(menu->decimals));
-		DisplayLine(0, line);
-		DisplayLine(4, stepSize == -1 ? "Reset: long press (Click +)" : "step: " + String(stepSize) + " (Click +)");
-		if (menu->change != NULL && oldVal != *(int*)menu->value) {
-			(*menu->change)(menu, 0);
-			oldVal = *(int*)menu->value;
-		}
-		while (!done && (button = ReadButton()) == BTN_NONE) {
-			delay(1);
-		}
-	} while (!done);
-	if (menu->change != NULL) {
-		(*menu->change)(menu, -1);
+		break;
 	}
+	// make sure within limits
+	*pValue = constrain(*pValue, menu->min, menu->max);
+	// show slider bar
+	tft.fillRect(0, 2 * tft.fontHeight(), tft.width() - 1, 6, TFT_BLACK);
+	DrawProgressBar(0, 2 * tft.fontHeight() + 5, tft.width() - 1, 6, map(*pValue, menu->min, menu->max, 0, 100));
+	sprintf(line, menu->text, *pValue / (int)pow10(menu->decimals), *pValue % (int)pow10(menu->decimals));
+	DisplayLine(0, line);
+	DisplayLine(4, task->stepSize == -1 ? "Reset: long press (Click +)" : "step: " + String(task->stepSize) + " (Click +)");
+	if (menu->change != NULL && task->lastValue != *pValue) {
+		// the callback sees the copy so it can show it, like the display brightness
+		const void* value = menu->value;
+		menu->value = pValue;
+		(*menu->change)(menu, 0);
+		menu->value = value;
+		task->lastValue = *pValue;
+	}
+	return false;
 }
 
 void SetDisplayBrightness(int val)
@@ -908,7 +2309,7 @@ void SetMenuColors(MenuItem* menu)
 	int mode = 0;	// 0 for active menu line, 1 for menu line
 	int colorIndex = FindMenuColor(menuLineColor);
 	int colorActiveIndex = FindMenuColor(menuLineActiveColor);
-	tft.fillScreen(TFT_BLACK);
+	ClearScreen();
 	DisplayLine(4, "Rotate change value");
 	DisplayLine(5, "Long Press Exit");
 	bool done = false;
@@ -974,6 +2375,7 @@ bool UpMenuLevel(bool gotoMain)
 // handle the menus
 bool HandleMenus()
 {
+	CProfileScope profile(Profiler, eProfHandleMenus);
 	if (bMenuChanged) {
 		ShowMenu(MenuStack.top()->menu);
 		bMenuChanged = false;
@@ -1019,9 +2421,10 @@ bool HandleMenus()
 		}
 		break;
 	case BTN_LONG:
-		tft.fillScreen(TFT_BLACK);
+		ClearScreen();
 		bSettingsMode = false;
 		bMenuChanged = true;
+		bRedrawStatus = true;
 		break;
 	default:
 		didsomething = false;
@@ -1040,10 +2443,39 @@ enum CRotaryDialButton::Button ReadButton()
 	enum CRotaryDialButton::Button retValue = BTN_NONE;
 	// read the next button, or NONE if none there
 	retValue = CRotaryDialButton::dequeue();
+	if (retValue != BTN_NONE) {
+		StartInputTrace();
+		lastActivityTime = millis();
+	}
 	delay(1);
 	return retValue;
 }
 
+// start following a button to the drawing it causes
+void StartInputTrace()
+{
+	inputTraceTime = CRotaryDialButton::lastTime();
+	inputReadTime = esp_timer_get_time();
+	bInputDrawn = false;
+	Profiler.addUs(eProfInputQueue, inputReadTime - inputTraceTime);
+}
+
+// at the end of a loop() pass, count the latency if the traced button drew something
+void FinishInputTrace()
+{
+	if (inputTraceTime == 0)
+		return;
+	int64_t now = esp_timer_get_time();
+	if (bInputDrawn) {
+		Profiler.addUs(eProfInputDraw, now - inputReadTime);
+		Profiler.addUs(eProfInput, now - inputTraceTime);
+		inputTraceTime = 0;
+	}
+	else if (now - inputReadTime > INPUT_TRACE_TIMEOUT_US) {
+		inputTraceTime = 0;
+	}
+}
+
 // the star is used to indicate active menu line
 void DisplayMenuLine(int line, int displine, String text)
 {
@@ -1054,17 +2486,738 @@ void DisplayMenuLine(int line, int displine, String text)
 }
 
 void DisplayLine(int line, String text, int16_t color)
+{
+	CProfileScope profile(Profiler, eProfDisplayLine);
+	if (line == TOAST_LINE) {
+		// remember it so it can be put back after a toast
+		toastLineText = text;
+		toastLineColor = color;
+		if (bToastShowing)
+			return;
+	}
+	DrawTextLine(line, text, color, TFT_BLACK);
+}
+
+void DrawTextLine(int line, const String& text, uint16_t color, uint16_t background)
 {
 	int charHeight = tft.fontHeight();
 	int y = line * charHeight;
-	tft.fillRect(0, y, tft.width(), charHeight, TFT_BLACK);
+	tft.fillRect(0, y, tft.width(), charHeight, background);
 	tft.setTextColor(color);
 	tft.drawString(text, 0, y);
+	// for the input latency
+	bInputDrawn = true;
+}
+
+// queue a message to show on the toast line for a while, this doesn't wait
+void ShowToast(String text, uint16_t color, int duration)
+{
+	TOAST toast = { text, color, duration };
+	// see if there is room in the queue
+	if (ToastQueue.size() < MAX_TOASTS)
+		ToastQueue.push(toast);
+}
+
+// called from loop(), shows the next toast and puts the line back when they are done
+void ServiceToasts()
+{
+	if (bToastShowing && (long)(millis() - toastExpires) >= 0) {
+		ToastQueue.pop();
+		bToastShowing = false;
+		if (ToastQueue.empty()) {
+			DrawTextLine(TOAST_LINE, toastLineText, toastLineColor, TFT_BLACK);
+		}
+	}
+	if (!bToastShowing && !ToastQueue.empty()) {
+		bToastShowing = true;
+		toastExpires = millis() + ToastQueue.front().duration;
+		bToastRedraw = true;
+	}
+	if (bToastShowing && bToastRedraw) {
+		DrawTextLine(TOAST_LINE, ToastQueue.front().text, ToastQueue.front().color, TFT_NAVY);
+	}
+	bToastRedraw = false;
+}
+
+// send the weight log as CSV, one block each step so the scale keeps running
+void SendLogToSerial(MenuItem* menu)
+{
+	StartUiTask(SendLogTask, menu);
+}
+
+// print one logged sample
+void PrintLogSample(uint16_t boot, uint16_t loadCell, uint32_t time, int32_t decigrams, void* arg)
+{
+	// the sign goes on its own, or -0.5 g would come out as 0.5
+	Serial.printf("%u,%u,%lu,%s%ld.%ld\n", boot, loadCell, (unsigned long)time, decigrams < 0 ? "-" : "", labs(decigrams) / 10, labs(decigrams) % 10);
+	++*(long*)arg;
+}
+
+bool SendLogTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	static long position;
+	static long samples;
+	if (task->step == 0) {
+		ClearScreen();
+		DisplayLine(0, "Sending Log...");
+		DisplayLine(1, String(WeightLog.size() / 1024) + "K in flash");
+		ClickContinue("Click to Stop");
+		Serial.println("boot,loadcell,seconds,grams");
+		position = samples = 0;
+		++task->step;
+	}
+	else if (btn != BTN_NONE || !WeightLog.replayNext(position, PrintLogSample, &samples)) {
+		ShowToast("Sent " + String(samples) + " samples");
+		return true;
+	}
+	return false;
+}
+
+// read commands from the serial port without waiting for them, a line longer than SERIAL_LINE_MAX is refused
+void ServiceSerial()
+{
+	while (Serial.available()) {
+		char ch = Serial.read();
+		if (ch == '\n' || ch == '\r') {
+			SerialLine.trim();
+			if (bSerialLineTooLong)
+				Serial.println("error: line too long");
+			else if (SerialLine.length())
+				HandleSerialCommand(SerialLine);
+			SerialLine = "";
+			bSerialLineTooLong = false;
+		}
+		else if (SerialLine.length() < SERIAL_LINE_MAX) {
+			SerialLine += ch;
+		}
+		else {
+			// a cut off command could do something else, like an import with half a record
+			bSerialLineTooLong = true;
+		}
+	}
+}
+
+// run one command line from the table
+void HandleSerialCommand(String line)
+{
+	int space = line.indexOf(' ');
+	String command = space == -1 ? line : line.substring(0, space);
+	String arg = space == -1 ? "" : line.substring(space + 1);
+	command.toLowerCase();
+	arg.trim();
+	lastActivityTime = millis();
+	for (int ix = 0; SerialCommands[ix].name; ++ix) {
+		if (command == SerialCommands[ix].name) {
+			(*SerialCommands[ix].function)(arg);
+			return;
+		}
+	}
+	Serial.println("error: unknown command: " + command + ", try help");
+}
+
+// finish a tare or calibration started from the serial port
+void ServiceConsole()
+{
+	switch (ConsoleOperation) {
+	case eConsoleTare:
+		if (!IsTareDone(&ConsoleTask))
+			return;
+		Serial.println("ok tare " + String(tareOffset[CHANNEL_INDEX]));
+		break;
+	case eConsoleSettle:
+		if (!IsSettled(&ConsoleTask))
+			return;
+		StartCalibration(&ConsoleTask, nConsoleCalibrateGrams);
+		ConsoleOperation = eConsoleCalibrate;
+		return;
+	case eConsoleCalibrate:
+		if (!IsCalibrationDone(&ConsoleTask))
+			return;
+		Serial.println("ok calibrate " + String(calibrationValue[CHANNEL_INDEX]));
+		break;
+	default:
+		return;
+	}
+	ConsoleOperation = eConsoleIdle;
+}
+
+// read a whole number, false if it isn't one or it is out of range
+bool ParseInt(String text, int& value, int low, int high)
+{
+	text.trim();
+	if (text.length() == 0)
+		return false;
+	for (unsigned ix = 0; ix < text.length(); ++ix) {
+		if (!isdigit(text[ix]) && !(ix == 0 && text[ix] == '-'))
+			return false;
+	}
+	value = text.toInt();
+	return value >= low && value <= high;
+}
+
+// show or change a setting, the display picks up the change
+void ConsoleSetting(const char* name, String arg, int& setting, int low, int high)
+{
+	if (arg.length()) {
+		int value;
+		if (!ParseInt(arg, value, low, high)) {
+			Serial.println("error: " + String(name) + " must be " + String(low) + " to " + String(high));
+			return;
+		}
+		setting = value;
+		bMenuChanged = true;
+		bRedrawStatus = true;
+	}
+	Serial.println("ok " + String(name) + " " + String(setting));
+}
+
+void CmdHelp(String arg)
+{
+	for (int ix = 0; SerialCommands[ix].name; ++ix) {
+		Serial.printf("%s %s: %s\n", SerialCommands[ix].name, SerialCommands[ix].args, SerialCommands[ix].help);
+	}
+	Serial.println("ok");
+}
+
+// change the stream subscriptions
+void StreamSubscribe(String arg, bool subscribe)
+{
+	uint8_t bits = 0;
+	arg.toLowerCase();
+	if (arg == "" || arg == "samples")
+		bits = STREAM_SUB_SAMPLES;
+	else if (arg == "state")
+		bits = STREAM_SUB_STATE;
+	else if (arg == "all")
+		bits = STREAM_SUB_SAMPLES | STREAM_SUB_STATE;
+	else {
+		Serial.println("error: subscribe samples, state, or all");
+		return;
+	}
+	if (subscribe) {
+		nStreamSubscriptions |= bits;
+		StreamHello();
+	}
+	else {
+		nStreamSubscriptions &= ~bits;
+	}
+	// samples not sent yet go now
+	if (!(nStreamSubscriptions & STREAM_SUB_SAMPLES) && nStreamSamples) {
+		StreamSend(StreamSamples);
+		nStreamSamples = 0;
+	}
+}
+
+void CmdSubscribe(String arg)
+{
+	StreamSubscribe(arg, true);
+}
+
+void CmdUnsubscribe(String arg)
+{
+	StreamSubscribe(arg, false);
+}
+
+void CmdWeight(String arg)
+{
+	if (!bFirstReading) {
+		Serial.println("error: no reading yet");
+		return;
+	}
+	Serial.println("ok weight " + String(ScaleState.weight, 1) + " filament " + String(ScaleState.filamentWeight) + " percent " + String(ScaleState.percent));
+}
+
+void CmdLoadCell(String arg)
+{
+	ConsoleSetting("loadcell", arg, nLoadCell, 1, LOADCELL_CHANNELS);
+}
+
+void CmdSpool(String arg)
+{
+	ConsoleSetting("spool", arg, ACTIVE_SPOOL, 1, MAX_SPOOLS);
+	if (arg.length())
+		bSpoolKnown[CHANNEL_INDEX] = true;
+}
+
+void CmdSpoolWeight(String arg)
+{
+	int grams = SpoolDb.spool(ACTIVE_SPOOL).emptyGrams;
+	ConsoleSetting("spoolweight", arg, grams, 0, 2000);
+	SpoolDb.setEmpty(ACTIVE_SPOOL, grams);
+}
+
+void CmdFullWeight(String arg)
+{
+	int grams = SpoolDb.spool(ACTIVE_SPOOL).netGrams;
+	ConsoleSetting("fullweight", arg, grams, 100, 3000);
+	SpoolDb.setNet(ACTIVE_SPOOL, grams);
+}
+
+void CmdMaterial(String arg)
+{
+	const CSpoolDb::SPOOLRECORD& spool = SpoolDb.spool(ACTIVE_SPOOL);
+	if (arg.length()) {
+		int space = arg.indexOf(' ');
+		int density, diameter;
+		if (space == -1 || !ParseInt(arg.substring(0, space), density, 800, 2500) || !ParseInt(arg.substring(space + 1), diameter, 100, 300)) {
+			Serial.println("error: material density diameter, 800 to 2500 and 100 to 300");
+			return;
+		}
+		SpoolDb.setMaterial(ACTIVE_SPOOL, density, diameter);
+		bMenuChanged = true;
+		bRedrawStatus = true;
+	}
+	Serial.println("ok material " + String(spool.density) + " " + String(spool.diameter) + " length " + String(spool.lengthConversion / 100.0, 2) + " m/kg");
+}
+
+void CmdTare(String arg)
+{
+	if (!bFoundLoadcell || ConsoleOperation != eConsoleIdle) {
+		Serial.println(bFoundLoadcell ? "error: busy" : "error: no load cell");
+		return;
+	}
+	// ServiceConsole() says when it is done
+	StartTare(&ConsoleTask);
+	ConsoleOperation = eConsoleTare;
+}
+
+void CmdCalibrate(String arg)
+{
+	if (!bFoundLoadcell || ConsoleOperation != eConsoleIdle) {
+		Serial.println(bFoundLoadcell ? "error: busy" : "error: no load cell");
+		return;
+	}
+	if (!ParseInt(arg, nConsoleCalibrateGrams, 1, 2000)) {
+		Serial.println("error: calibrate grams, 1 to 2000");
+		return;
+	}
+	// wait for the dataset to fill with readings of the mass
+	StartSettling(&ConsoleTask);
+	ConsoleOperation = eConsoleSettle;
+}
+
+// the spools that have a weight, as lines that can be sent back with import
+// each line has to fit in SERIAL_LINE_MAX with the import in front, or the import would get it cut short
+void CmdExport(String arg)
+{
+	String line = "import";
+	for (int ix = 1; ix <= MAX_SPOOLS; ++ix) {
+		const CSpoolDb::SPOOLRECORD& spool = SpoolDb.spool(ix);
+		if (spool.emptyGrams == 0)
+			continue;
+		String record = " " + String(ix) + "=" + String(spool.emptyGrams) + "/" + String(spool.netGrams) + "/" + String(spool.density) + "/" + String(spool.diameter);
+		if (line.length() + record.length() > SERIAL_LINE_MAX) {
+			if (!ExportLine(line))
+				return;
+			line = "import";
+		}
+		line += record;
+	}
+	if (line.length() > 6 && !ExportLine(line))
+		return;
+	Serial.println("ok");
+}
+
+// send an export line after reading it back the way import will, so an export that can't be imported says so
+bool ExportLine(String line)
+{
+	SPOOLIMPORT records[SERIAL_LINE_MAX / 4];
+	String error;
+	int count = line.length() <= SERIAL_LINE_MAX ? ParseImport(line.substring(7), records, error) : -1;
+	for (int ix = 0; ix < count; ++ix) {
+		const CSpoolDb::SPOOLRECORD& spool = SpoolDb.spool(records[ix].spool);
+		if (records[ix].grams != spool.emptyGrams || records[ix].net != spool.netGrams || records[ix].density != spool.density || records[ix].diameter != spool.diameter)
+			count = -1;
+	}
+	if (count <= 0) {
+		Serial.println("error: export doesn't import: " + line);
+		return false;
+	}
+	Serial.println(line);
+	return true;
+}
+
+// spool=grams pairs, or spool=grams/net/density/diameter, returns how many or -1 with the error
+// the fields that are left out are -1
+int ParseImport(String arg, SPOOLIMPORT* records, String& error)
+{
+	int count = 0;
+	arg += ' ';
+	for (int start = 0, end; (end = arg.indexOf(' ', start)) != -1; start = end + 1) {
+		String pair = arg.substring(start, end);
+		if (pair.length() == 0)
+			continue;
+		if (count >= SERIAL_LINE_MAX / 4) {
+			error = "too many spools";
+			return -1;
+		}
+		SPOOLIMPORT& record = records[count];
+		int equals = pair.indexOf('=');
+		int slash = pair.indexOf('/');
+		if (equals == -1 || !ParseInt(pair.substring(0, equals), record.spool, 1, MAX_SPOOLS)
+			|| !ParseInt(pair.substring(equals + 1, slash == -1 ? pair.length() : slash), record.grams, 0, 2000)) {
+			error = "bad spool=grams: " + pair;
+			return -1;
+		}
+		record.net = record.density = record.diameter = -1;
+		if (slash != -1) {
+			String rest = pair.substring(slash + 1) + '/';
+			int* fields[] = { &record.net, &record.density, &record.diameter };
+			const int low[] = { 100, 800, 100 }, high[] = { 3000, 2500, 300 };
+			for (int field = 0, start = 0, end; field < 3; ++field, start = end + 1) {
+				end = rest.indexOf('/', start);
+				if (end == -1 || !ParseInt(rest.substring(start, end), *fields[field], low[field], high[field])) {
+					error = "bad spool=grams/net/density/diameter: " + pair;
+					return -1;
+				}
+			}
+		}
+		++count;
+	}
+	return count;
+}
+
+// they are all checked before any are changed, the fields that are left out stay as they are
+void CmdImport(String arg)
+{
+	SPOOLIMPORT records[SERIAL_LINE_MAX / 4];
+	String error;
+	int count = ParseImport(arg, records, error);
+	if (count < 0) {
+		Serial.println("error: " + error);
+		return;
+	}
+	for (int ix = 0; ix < count; ++ix) {
+		SpoolDb.setEmpty(records[ix].spool, records[ix].grams);
+		if (records[ix].net != -1) {
+			SpoolDb.setNet(records[ix].spool, records[ix].net);
+			SpoolDb.setMaterial(records[ix].spool, records[ix].density, records[ix].diameter);
+		}
+	}
+	bMenuChanged = true;
+	bRedrawStatus = true;
+	Serial.println("ok import " + String(count));
+}
+
+void CmdSleep(String arg)
+{
+	ConsoleSetting("sleep", arg, nIdleMinutes, 0, 120);
+}
+
+#ifdef TELEMETRY
+// the SSID can't have a space in it, the password is the rest of the line, - forgets the network
+void CmdWifi(String arg)
+{
+	if (arg.length()) {
+		int space = arg.indexOf(' ');
+		String ssid = arg == "-" ? "" : space == -1 ? arg : arg.substring(0, space);
+		String password = space == -1 ? "" : arg.substring(space + 1);
+		if (ssid.length() >= sizeof(WifiSsid) || password.length() >= sizeof(WifiPassword)) {
+			Serial.println("error: the ssid can be 32 characters and the password 64");
+			return;
+		}
+		strcpy(WifiSsid, ssid.c_str());
+		strcpy(WifiPassword, password.c_str());
+		SendTelemetrySettings();
+		bMenuChanged = true;
+	}
+	// the password isn't shown
+	Serial.println("ok wifi " + String(*WifiSsid ? WifiSsid : "-") + " " + (WiFi.status() == WL_CONNECTED ? WiFi.localIP().toString() : String("not connected")));
+}
+
+void CmdMqtt(String arg)
+{
+	if (arg.length()) {
+		int space = arg.indexOf(' ');
+		String host = arg == "-" ? "" : space == -1 ? arg : arg.substring(0, space);
+		int port = nMqttPort;
+		if (host.length() >= sizeof(MqttHost) || (space != -1 && !ParseInt(arg.substring(space + 1), port, 1, 65535))) {
+			Serial.println("error: mqtt host port, the host can be 64 characters and the port 1 to 65535");
+			return;
+		}
+		strcpy(MqttHost, host.c_str());
+		nMqttPort = port;
+		SendTelemetrySettings();
+		bMenuChanged = true;
+	}
+	Serial.println("ok mqtt " + String(*MqttHost ? MqttHost : "-") + " " + String(nMqttPort) + (bMqttConnected ? " connected" : " not connected"));
+}
+
+void CmdTelemetry(String arg)
+{
+	Serial.printf("ok telemetry %s wifi %s mqtt %s websocket %d:%d sent %lu coalesced %lu\n", bTelemetryOn ? "on" : "off",
+		WiFi.status() == WL_CONNECTED ? WiFi.localIP().toString().c_str() : "-", bMqttConnected ? "connected" : "-",
+		TELEMETRY_WS_PORT, nWebSocketClients, nTelemetrySent, nTelemetryCoalesced);
+}
+#endif
+
+void CmdRunout(String arg)
+{
+	if (arg.length()) {
+		int space = arg.indexOf(' ');
+		int grams, minutes = nRunoutMinutes;
+		if (!ParseInt(space == -1 ? arg : arg.substring(0, space), grams, 0, 1000)
+			|| (space != -1 && !ParseInt(arg.substring(space + 1), minutes, 0, 600))) {
+			Serial.println("error: runout grams minutes, 0 to 1000 and 0 to 600");
+			return;
+		}
+		nRunoutGrams = grams;
+		nRunoutMinutes = minutes;
+		bMenuChanged = true;
+	}
+	String out;
+	for (int ch = 0; ch < LOADCELL_CHANNELS; ++ch)
+		out += ScaleStates[ch].bRunout ? " out" : " ok";
+	Serial.println("ok runout " + String(nRunoutGrams) + " " + String(nRunoutMinutes) + out);
+}
+
+// the inventory as CSV in one go, new spools were given a number and taken to be full
+void CmdInventory(String arg)
+{
+	if (arg == "clear") {
+		nInventoryItems = 0;
+		Serial.println("ok");
+		return;
+	}
+	Serial.println("time,spool,grams,meters,weight,new");
+	for (int ix = 0; ix < nInventoryItems; ++ix) {
+		const INVENTORYITEM& item = InventoryItems[ix];
+		Serial.printf("%lu,%d,%d,%.1f,%.1f,%d\n", (unsigned long)item.time, item.spool, item.filamentWeight, item.length, item.weight, item.bNew);
+	}
+	Serial.println("ok inventory " + String(nInventoryItems));
+}
+
+void CmdProfile(String arg)
+{
+	if (arg == "reset")
+		Profiler.reset();
+	else
+		Profiler.print(Serial);
+	Serial.println("ok");
+}
+
+void CmdLatency(String arg)
+{
+	for (int ix = eProfInputQueue; ix <= eProfInput; ++ix) {
+		Serial.printf("%s: count %lu p50 %lu p99 %lu max %lu uS\n", Profiler.probe(ix).name, (unsigned long)Profiler.probe(ix).count,
+			(unsigned long)Profiler.percentile(ix, 50), (unsigned long)Profiler.percentile(ix, 99), (unsigned long)Profiler.probe(ix).maxUs);
+	}
+	Serial.println("ok");
+}
+
+void CmdDiag(String arg)
+{
+	Serial.printf("sps %.2f of %d\n", ScaleState.achievedSps, ScaleState.detectedSps);
+	Serial.printf("filter %d samples, stable after %d\n", ScaleState.samplesInUse, ScaleState.stableConversions);
+	Serial.printf("missed conversions %lu of %lu\n", ScaleState.missedConversions, ScaleState.conversions);
+	for (int ix = eProfUpdateGap; ix <= eProfLoopPeriod; ++ix) {
+		Serial.printf("%s: p50 %lu p99 %lu max %lu uS\n", Profiler.probe(ix).name,
+			(unsigned long)Profiler.percentile(ix, 50), (unsigned long)Profiler.percentile(ix, 99), (unsigned long)Profiler.probe(ix).maxUs);
+	}
+	Serial.println("ok");
+}
+
+void CmdSave(String arg)
+{
+	Serial.println(SaveLoadSettings(true) ? "ok" : "error: save failed");
+}
+
+// send a frame if the serial buffer has room for it, otherwise drop it, the host sees the gap in the sequence
+void StreamSend(CStreamFrame& frame)
+{
+	// a 0 first ends anything printed since the last frame, so it isn't taken as the start of this one
+	static uint8_t encoded[STREAM_MAX_ENCODED + 1];
+	encoded[0] = 0;
+	int length = frame.finish(encoded + 1) + 1;
+	if (Serial.availableForWrite() >= length)
+		Serial.write(encoded, length);
+	else
+		++nStreamDropped;
+}
+
+// tell the host what it needs to make sense of the counts
+void StreamHello()
+{
+	CStreamFrame frame;
+	frame.begin(STREAM_HELLO, nStreamSequence++);
+	frame.put8(STREAM_VERSION);
+	frame.putFloat(ScaleState.calFactor);
+	frame.put32(ScaleState.tareOffset);
+	frame.putFloat(ScaleState.sps);
+	StreamSend(frame);
+}
+
+// add a conversion from the acquisition task to the batch
+void StreamSample(STREAMSAMPLE& sample)
+{
+	if (nStreamSamples == 0) {
+		StreamSamples.begin(STREAM_SAMPLES, nStreamSequence++);
+		StreamSamples.put8(0);
+		streamSamplesStart = millis();
+	}
+	StreamSamples.put32(sample.micros);
+	StreamSamples.put32(sample.counts);
+	StreamSamples.putFloat(sample.grams);
+	StreamSamples.set8(0, ++nStreamSamples);
+	if (nStreamSamples >= STREAM_MAX_SAMPLES) {
+		StreamSend(StreamSamples);
+		nStreamSamples = 0;
+	}
+}
+
+// an alarm goes out as it happens to a host that has the state subscribed
+void StreamEvent(int channel, uint8_t event, bool active, float value)
+{
+	if (!(nStreamSubscriptions & STREAM_SUB_STATE))
+		return;
+	CStreamFrame frame;
+	frame.begin(STREAM_EVENT, nStreamSequence++);
+	frame.put32(millis());
+	frame.put8(channel + 1);
+	frame.put8(event);
+	frame.put8(active);
+	frame.putFloat(value);
+	StreamSend(frame);
+}
+
+// send batches that have waited long enough and the state when it is due
+void ServiceStream()
+{
+	if (nStreamSamples && millis() - streamSamplesStart >= STREAM_BATCH_MS) {
+		StreamSend(StreamSamples);
+		nStreamSamples = 0;
+	}
+	if ((nStreamSubscriptions & STREAM_SUB_STATE) && bFirstReading && millis() - streamStateTime >= STREAM_STATE_MS) {
+		streamStateTime = millis();
+		CStreamFrame frame;
+		frame.begin(STREAM_STATE, nStreamSequence++);
+		frame.put32(millis());
+		frame.putFloat(ScaleState.weight);
+		frame.put32(ScaleState.filamentWeight);
+		frame.put8(ScaleState.percent);
+		frame.putFloat(ScaleState.length);
+		frame.putFloat(ScaleState.bRateValid ? ScaleState.rate : 0);
+		frame.put32(ScaleState.bRateValid ? lround(ScaleState.minutesLeft) : -1);
+		StreamSend(frame);
+	}
+}
+
+// warn when sampling falls behind or loop() stalls, once in a while
+void CheckTimingAlarm()
+{
+	static unsigned long lastCheck = 0;
+	if (!bFirstReading || millis() - lastCheck < DIAG_WINDOW_MS)
+		return;
+	lastCheck = millis();
+	unsigned long missed = ScaleState.missedConversions - diagLastMissed;
+	uint32_t loopMax = Profiler.probe(eProfLoopPeriod).maxUs;
+	bool bLoopSlow = loopMax > diagLastLoopMax && loopMax > DIAG_ALARM_LOOP_MS * 1000UL;
+	diagLastMissed = ScaleState.missedConversions;
+	diagLastLoopMax = loopMax;
+	String alarm;
+	// the rate is 0 until the first window is done
+	if (ScaleState.achievedSps > 0 && ScaleState.achievedSps * 100 < ScaleState.detectedSps * DIAG_ALARM_SPS_PERCENT)
+		alarm = "Slow HX711: " + String(ScaleState.achievedSps, 1) + " SPS";
+	else if (missed)
+		alarm = "Missed " + String(missed) + " conversions";
+	else if (bLoopSlow)
+		alarm = "Slow loop: " + String(loopMax / 1000) + " mS";
+	if (alarm.length() == 0 || (diagAlarmTime && millis() - diagAlarmTime < DIAG_ALARM_REPEAT_MS))
+		return;
+	diagAlarmTime = millis();
+	ShowToast(alarm, TFT_RED, 3000);
+	Serial.println("alarm: " + alarm);
+}
+
+// show the timing numbers
+void ShowDiagnostics(MenuItem* menu)
+{
+	StartUiTask(ShowDiagnosticsTask, menu);
+}
+
+bool ShowDiagnosticsTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	if (btn != BTN_NONE && task->step)
+		return true;
+	if (task->step == 0 || millis() >= task->timer) {
+		if (task->step == 0) {
+			ClearScreen();
+			ClickContinue();
+			task->step = 1;
+		}
+		task->timer = millis() + 1000;
+		DisplayLine(0, "SPS: " + String(ScaleState.achievedSps, 1) + " of " + String(ScaleState.detectedSps) + ", avg " + String(ScaleState.samplesInUse));
+		DisplayLine(1, "Missed: " + String(ScaleState.missedConversions));
+		DisplayLine(2, "Update gap p99: " + String(Profiler.percentile(eProfUpdateGap, 99) / 1000.0, 1) + " mS");
+		DisplayLine(3, "Update gap max: " + String(Profiler.probe(eProfUpdateGap).maxUs / 1000.0, 1) + " mS");
+		DisplayLine(4, "Loop p99: " + String(Profiler.percentile(eProfLoopPeriod, 99) / 1000.0, 1) + " mS");
+		DisplayLine(5, "Loop max: " + String(Profiler.probe(eProfLoopPeriod).maxUs / 1000.0, 1) + " mS");
+	}
+	return false;
+}
+
+// show the profiler numbers, turn the dial for the next probe
+void ShowProfiler(MenuItem* menu)
+{
+	StartUiTask(ShowProfilerTask, menu);
+}
+
+bool ShowProfilerTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	if (btn == BTN_SELECT || btn == BTN_LONG)
+		return true;
+	// lastValue is the probe showing
+	if (btn == BTN_RIGHT)
+		task->lastValue = (task->lastValue + 1) % Profiler.count();
+	else if (btn == BTN_LEFT)
+		task->lastValue = (task->lastValue + Profiler.count() - 1) % Profiler.count();
+	if (task->step == 0 || btn != BTN_NONE || millis() >= task->timer) {
+		if (task->step == 0) {
+			ClearScreen();
+			ClickContinue("Turn: Next  Click: Exit");
+			task->step = 1;
+		}
+		task->timer = millis() + 1000;
+		int ix = task->lastValue;
+		const CProfiler::PROBE& probe = Profiler.probe(ix);
+		DisplayLine(0, String(probe.name) + " " + String(ix + 1) + "/" + String(Profiler.count()));
+		DisplayLine(1, "Count: " + String(probe.count));
+		DisplayLine(2, "Avg: " + String(probe.count ? (unsigned long)(probe.totalUs / probe.count) : 0) + " uS");
+		DisplayLine(3, "P50: " + String(Profiler.percentile(ix, 50)) + " uS");
+		DisplayLine(4, "P99: " + String(Profiler.percentile(ix, 99)) + " uS");
+		DisplayLine(5, "Max: " + String(probe.maxUs) + " uS");
+	}
+	return false;
+}
+
+// show how much filament the active spool used lately
+void ShowSpoolUsage(MenuItem* menu)
+{
+	StartUiTask(SpoolUsageTask, menu);
+}
+
+bool SpoolUsageTask(UiTask* task, CRotaryDialButton::Button btn)
+{
+	static const char* periods[] = { "Last Day", "Last Week", "Last Month", "Last Year" };
+	if (task->step == 0) {
+		ClearScreen();
+		DisplayLine(0, "Spool " + String(nActiveSpool[CHANNEL_INDEX]) + " Usage");
+		for (int ix = 0; ix < 4; ++ix) {
+			uint32_t used = SpoolStats.used(time(NULL), nActiveSpool[CHANNEL_INDEX], (decltype(SpoolStats)::Period)ix);
+			DisplayLine(ix + 1, String(periods[ix]) + ": " + String(used / 10) + "." + String(used % 10) + " g");
+		}
+		ClickContinue();
+		++task->step;
+	}
+	else if (btn != BTN_NONE) {
+		return true;
+	}
+	return false;
 }
 
 void SetFactorySettings(MenuItem* menu)
 {
-	EEPROM.begin(1024);
+	EEPROM.begin(SETTINGS_EEPROM_SIZE);
 	byte data[2];
 	data[0] = 0;
 	data[1] = 0;
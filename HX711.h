@@ -0,0 +1,226 @@
+#pragma once
+#include <stdint.h>
+// HX711 driver
+// CHX711 is the protocol, the Pins class it is built on moves the clock and reads the data line,
+// so the pin numbers are template arguments and the register masks are worked out by the compiler
+// the protocol part doesn't need Arduino, a host build can give it pins that simulate an HX711
+//
+// a conversion is ready when DOUT goes low, then 24 clock pulses read the bits MSB first, and 1 to 3
+// more pulses pick the channel and gain for the conversion after that one
+// the clock must not stay high for 60uS or the HX711 powers down
+// several HX711s can share the clock, each with its own data pin, they are all clocked and read together
+#define HX711_GAIN_A128 1               // extra pulses after the 24 data bits
+#define HX711_GAIN_B32 2
+#define HX711_GAIN_A64 3
+
+// the mask of the data pins, the pins must be below 32 so they are all in the first GPIO registers
+template <int PIN, int... MORE>
+struct CHX711Mask {
+    static_assert(PIN < 32, "the HX711 pins must be GPIO 0 to 31");
+    static const uint32_t value = (1UL << PIN) | CHX711Mask<MORE...>::value;
+};
+template <int PIN>
+struct CHX711Mask<PIN> {
+    static_assert(PIN < 32, "the HX711 pins must be GPIO 0 to 31");
+    static const uint32_t value = 1UL << PIN;
+};
+
+// the bit level protocol, Pins gives count, clockHigh(), clockLow(), halfPeriod(), inputs() and dout()
+template <class Pins>
+struct CHX711BitBang {
+    // clock out the 24 data bits and the gain pulses, values gets the 24 bits from each HX711
+    static void shiftIn(int gainPulses, uint32_t* values)
+    {
+        for (int ix = 0; ix < Pins::count; ++ix)
+            values[ix] = 0;
+        for (int bit = 0; bit < 24 + gainPulses; ++bit) {
+            Pins::clockHigh();
+            Pins::halfPeriod();
+            // DOUT changes after the rising edge, so read them before the falling one
+            uint32_t in = Pins::inputs();
+            Pins::clockLow();
+            if (bit < 24) {
+                for (int ix = 0; ix < Pins::count; ++ix)
+                    values[ix] = (values[ix] << 1) | ((in >> Pins::dout(ix)) & 1);
+            }
+            Pins::halfPeriod();
+        }
+    }
+};
+
+template <class Pins>
+class CHX711 {
+private:
+    int m_nGainPulses = HX711_GAIN_A128;
+public:
+    void begin(int gain = HX711_GAIN_A128)
+    {
+        m_nGainPulses = gain;
+        Pins::begin();
+    }
+    // the new gain is sent with the next read, so it is used from the conversion after that
+    void setGain(int gain)
+    {
+        m_nGainPulses = gain;
+    }
+    int getGain()
+    {
+        return m_nGainPulses;
+    }
+    // how many HX711s share the clock
+    static int count()
+    {
+        return Pins::count;
+    }
+    // true when all of them have a conversion
+    bool ready()
+    {
+        return Pins::ready();
+    }
+    // read a conversion from each, only call this when ready()
+    // the values are offset binary like HX711_ADC uses, 0 is the most negative and 0x800000 is zero
+    void read(uint32_t* values)
+    {
+        Pins::shiftIn(m_nGainPulses, values);
+        for (int ix = 0; ix < Pins::count; ++ix)
+            values[ix] ^= 0x800000;
+    }
+    // after power up the HX711 starts on channel A at 128, the next read sends the gain again
+    void powerDown()
+    {
+        Pins::powerDown();
+    }
+    void powerUp()
+    {
+        Pins::powerUp();
+    }
+};
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <driver/spi_master.h>
+#include <soc/gpio_struct.h>
+#include <soc/spi_periph.h>
+#include <rom/ets_sys.h>
+#include <rom/gpio.h>
+
+// GPIO register access, the clock pin and then a data pin for each HX711
+template <int SCK, int... DOUT>
+struct CHX711Pins {
+    static const int count = sizeof...(DOUT);
+    static const uint32_t mask = CHX711Mask<DOUT...>::value;
+    static_assert(SCK < 32, "the HX711 pins must be GPIO 0 to 31");
+    static int dout(int ix)
+    {
+        static const int pins[] = { DOUT... };
+        return pins[ix];
+    }
+    static void begin()
+    {
+        for (int ix = 0; ix < count; ++ix)
+            pinMode(dout(ix), INPUT);
+        pinMode(SCK, OUTPUT);
+        clockLow();
+    }
+    static inline void clockHigh()
+    {
+        GPIO.out_w1ts = 1UL << SCK;
+    }
+    static inline void clockLow()
+    {
+        GPIO.out_w1tc = 1UL << SCK;
+    }
+    static inline uint32_t inputs()
+    {
+        return GPIO.in;
+    }
+    static inline bool ready()
+    {
+        return (GPIO.in & mask) == 0;
+    }
+    // the HX711 needs 0.2uS high and low
+    static inline void halfPeriod()
+    {
+        ets_delay_us(1);
+    }
+    // an interrupt in the middle could hold the clock high long enough to power the HX711 down
+    static void shiftIn(int gainPulses, uint32_t* values)
+    {
+        static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+        portENTER_CRITICAL(&mux);
+        CHX711BitBang<CHX711Pins>::shiftIn(gainPulses, values);
+        portEXIT_CRITICAL(&mux);
+    }
+    static void powerDown()
+    {
+        clockLow();
+        clockHigh();
+    }
+    static void powerUp()
+    {
+        clockLow();
+    }
+};
+
+// the SPI peripheral makes the clock pulses and shifts the bits in, the task waits for the
+// transaction to finish instead of toggling pins and interrupts stay on
+// the display is on VSPI so this uses HSPI, the pins go through the GPIO matrix
+// MOSI isn't used, DOUT is MISO, and mode 1 reads the bits on the falling edge
+// there is only one MISO, so this is for one HX711
+#define HX711_SPI_HOST SPI2_HOST
+#define HX711_SPI_HZ 1000000
+template <int SCK, int DOUT>
+struct CHX711SpiPins {
+    static const int count = 1;
+    static spi_device_handle_t& device()
+    {
+        static spi_device_handle_t handle = NULL;
+        return handle;
+    }
+    static void begin()
+    {
+        spi_bus_config_t bus = {};
+        bus.mosi_io_num = -1;
+        bus.miso_io_num = DOUT;
+        bus.sclk_io_num = SCK;
+        bus.quadwp_io_num = -1;
+        bus.quadhd_io_num = -1;
+        bus.max_transfer_sz = 4;
+        spi_bus_initialize(HX711_SPI_HOST, &bus, SPI_DMA_DISABLED);
+        spi_device_interface_config_t dev = {};
+        dev.mode = 1;
+        dev.clock_speed_hz = HX711_SPI_HZ;
+        dev.spics_io_num = -1;
+        dev.queue_size = 1;
+        spi_bus_add_device(HX711_SPI_HOST, &dev, &device());
+    }
+    // the pin can still be read while the SPI has it
+    static inline bool ready()
+    {
+        return !((GPIO.in >> DOUT) & 1);
+    }
+    static void shiftIn(int gainPulses, uint32_t* values)
+    {
+        spi_transaction_t trans = {};
+        trans.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+        // the length is the number of clock pulses
+        trans.length = 24 + gainPulses;
+        trans.rxlength = 24 + gainPulses;
+        if (spi_device_transmit(device(), &trans) != ESP_OK)
+            values[0] = 0;
+        else
+            values[0] = ((uint32_t)trans.rx_data[0] << 16) | ((uint32_t)trans.rx_data[1] << 8) | trans.rx_data[2];
+    }
+    // take the clock pin back from the SPI to hold it high
+    static void powerDown()
+    {
+        GPIO.out_w1ts = 1UL << SCK;
+        gpio_matrix_out(SCK, SIG_GPIO_OUT_IDX, false, false);
+    }
+    static void powerUp()
+    {
+        GPIO.out_w1tc = 1UL << SCK;
+        gpio_matrix_out(SCK, spi_periph_signal[HX711_SPI_HOST].spiclk_out, false, false);
+    }
+};
+#endif
@@ -0,0 +1,261 @@
+#pragma once
+#include <Arduino.h>
+#include "HX711.h"
+// the load cell readings from the HX711s, smoothed, tared and calibrated
+// it works like HX711_ADC and uses the same units, so the saved tare offset and calibration factor still fit:
+// the readings are offset binary, the smoothed value is the average of the dataset without its highest and
+// lowest reading, and grams are (smoothed - tare offset) / calibration factor
+#define LOADCELL_SAMPLES 16             // in the average, a power of two
+#define LOADCELL_MAX_SAMPLES 256
+#define LOADCELL_IGNORE 2               // the highest and lowest readings in the dataset are left out
+#define LOADCELL_POWERUP_SKIP 4         // conversions the HX711 needs to settle after power up, 400mS at 10 SPS
+
+// the filter, tare, and calibration for one load cell
+class CLoadCellChannel {
+private:
+    uint32_t m_dataset[LOADCELL_MAX_SAMPLES + LOADCELL_IGNORE];
+    int m_nSamplesInUse = LOADCELL_SAMPLES;
+    int m_nDivBits = 4;
+    int m_nIndex = 0;
+    int m_nFilled = 0;                  // readings in the dataset
+    int m_nSkip = 0;                    // readings to throw away
+    uint32_t m_nRaw = 0;                // the last reading
+    long m_nSmoothed = 0;
+    long m_nTareOffset = 0;
+    float m_calFactor = 1.0;
+    bool m_bTaring = false;
+    int m_nTareCount = 0;               // readings since the tare started
+    bool m_bTareDone = false;
+    int datasetSize()
+    {
+        return m_nSamplesInUse + LOADCELL_IGNORE;
+    }
+public:
+    void add(uint32_t raw)
+    {
+        m_nRaw = raw;
+        if (m_nSkip) {
+            --m_nSkip;
+            return;
+        }
+        m_dataset[m_nIndex] = raw;
+        m_nIndex = (m_nIndex + 1) % datasetSize();
+        if (m_nFilled < datasetSize())
+            ++m_nFilled;
+        uint64_t sum = 0;
+        uint32_t low = 0xffffffff, high = 0;
+        for (int ix = 0; ix < m_nFilled; ++ix) {
+            uint32_t value = m_dataset[ix];
+            sum += value;
+            low = min(low, value);
+            high = max(high, value);
+        }
+        // until the dataset is full use a plain average
+        if (m_nFilled < datasetSize())
+            m_nSmoothed = (long)(sum / m_nFilled);
+        else
+            m_nSmoothed = (long)((sum - low - high) >> m_nDivBits);
+        if (m_bTaring && ++m_nTareCount >= datasetSize()) {
+            m_nTareOffset = m_nSmoothed;
+            m_bTaring = false;
+            m_bTareDone = true;
+        }
+    }
+    // start filling the dataset again, after skipping some readings
+    void restart(int skip = 0)
+    {
+        m_nSkip = skip;
+        m_nIndex = 0;
+        m_nFilled = 0;
+    }
+    float getData()
+    {
+        return (m_nSmoothed - m_nTareOffset) / m_calFactor;
+    }
+    // the last conversion without smoothing, tare or calibration
+    uint32_t getRaw()
+    {
+        return m_nRaw;
+    }
+    // the last conversion in grams, without smoothing
+    float getRawData()
+    {
+        return ((long)m_nRaw - m_nTareOffset) / m_calFactor;
+    }
+    // the smoothed reading is good once the dataset is full
+    bool getDataSetStatus()
+    {
+        return m_nFilled >= datasetSize();
+    }
+    // the tare is done by add() when a whole dataset has been read since this
+    void tareNoDelay()
+    {
+        m_bTaring = true;
+        m_nTareCount = 0;
+        m_bTareDone = false;
+    }
+    bool isTaring()
+    {
+        return m_bTaring;
+    }
+    // true once when the tare has finished
+    bool getTareStatus()
+    {
+        bool done = m_bTareDone;
+        m_bTareDone = false;
+        return done;
+    }
+    long getTareOffset()
+    {
+        return m_nTareOffset;
+    }
+    void setTareOffset(long offset)
+    {
+        m_nTareOffset = offset;
+    }
+    float getCalFactor()
+    {
+        return m_calFactor;
+    }
+    void setCalFactor(float factor)
+    {
+        m_calFactor = factor;
+    }
+    // the factor that makes the weight on the scale read as known grams
+    float getNewCalibration(float known)
+    {
+        m_calFactor = (m_nSmoothed - m_nTareOffset) / known;
+        return m_calFactor;
+    }
+    int getSamplesInUse()
+    {
+        return m_nSamplesInUse;
+    }
+    // rounded down to a power of two, if it changes the dataset starts filling again
+    void setSamplesInUse(int samples)
+    {
+        samples = constrain(samples, 1, LOADCELL_MAX_SAMPLES);
+        if (1 << (31 - __builtin_clz(samples)) == m_nSamplesInUse)
+            return;
+        m_nDivBits = 31 - __builtin_clz(samples);
+        m_nSamplesInUse = 1 << m_nDivBits;
+        restart();
+    }
+};
+
+// the HX711s on one clock, every update() reads a conversion from all of them
+template <class Pins>
+class CLoadCell {
+private:
+    CHX711<Pins> m_hx711;
+    CLoadCellChannel m_channels[Pins::count];
+    unsigned long m_nLastConversionUs = 0;
+    float m_conversionMs = 0;
+    unsigned long m_nStartMs = 0;
+    unsigned long m_nSettlingMs = 0;
+    bool m_bStarted = false;
+public:
+    CLoadCell(int gain = HX711_GAIN_A128)
+    {
+        m_hx711.setGain(gain);
+    }
+    // power up, the readings aren't good until startMultiple() says so
+    void begin()
+    {
+        m_hx711.begin(m_hx711.getGain());
+        m_nStartMs = millis();
+    }
+    // keep converting until the HX711s have had ms to settle, returns 1 when they have and the tare is done
+    int startMultiple(unsigned long ms, bool tare)
+    {
+        update();
+        if (!m_bStarted) {
+            if (millis() - m_nStartMs < ms)
+                return 0;
+            m_bStarted = true;
+            m_nSettlingMs = millis() - m_nStartMs;
+            if (tare) {
+                for (int ix = 0; ix < Pins::count; ++ix)
+                    m_channels[ix].tareNoDelay();
+            }
+        }
+        for (int ix = 0; ix < Pins::count; ++ix) {
+            if (m_channels[ix].isTaring())
+                return 0;
+        }
+        return 1;
+    }
+    // read the conversions if they are all ready, returns 1 if they were
+    // they share the clock, so one that is slow to be ready holds the others up
+    uint8_t update()
+    {
+        if (!m_hx711.ready())
+            return 0;
+        uint32_t values[Pins::count];
+        m_hx711.read(values);
+        unsigned long now = micros();
+        if (m_nLastConversionUs) {
+            float ms = (now - m_nLastConversionUs) / 1000.0;
+            m_conversionMs = m_conversionMs ? m_conversionMs + (ms - m_conversionMs) / 8 : ms;
+        }
+        m_nLastConversionUs = now;
+        for (int ix = 0; ix < Pins::count; ++ix)
+            m_channels[ix].add(values[ix]);
+        return 1;
+    }
+    int channels()
+    {
+        return Pins::count;
+    }
+    CLoadCellChannel& operator[](int channel)
+    {
+        return m_channels[channel];
+    }
+    int getSamplesInUse()
+    {
+        return m_channels[0].getSamplesInUse();
+    }
+    void setSamplesInUse(int samples)
+    {
+        for (int ix = 0; ix < Pins::count; ++ix)
+            m_channels[ix].setSamplesInUse(samples);
+    }
+    float getConversionTime()
+    {
+        return m_conversionMs;
+    }
+    float getSPS()
+    {
+        return m_conversionMs ? 1000.0 / m_conversionMs : 0;
+    }
+    unsigned long getSettlingTime()
+    {
+        return m_nSettlingMs;
+    }
+    // the gain is the same for all of them, since they are all clocked together
+    // the reading that sends the new gain was converted with the old one, so it is skipped and the datasets start again
+    void setGain(int gain)
+    {
+        if (gain == m_hx711.getGain())
+            return;
+        m_hx711.setGain(gain);
+        for (int ix = 0; ix < Pins::count; ++ix)
+            m_channels[ix].restart(1);
+    }
+    int getGain()
+    {
+        return m_hx711.getGain();
+    }
+    void powerDown()
+    {
+        m_hx711.powerDown();
+    }
+    // the first conversions are still settling, and are at 128 on channel A until the gain has gone out again
+    void powerUp()
+    {
+        m_hx711.powerUp();
+        m_nLastConversionUs = 0;
+        for (int ix = 0; ix < Pins::count; ++ix)
+            m_channels[ix].restart(LOADCELL_POWERUP_SKIP);
+    }
+};
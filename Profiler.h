@@ -0,0 +1,109 @@
+#pragma once
+#include <Arduino.h>
+// time spent in the busy parts of the code
+// each probe has a histogram with a bucket for each power of two microseconds, so adding a time is a
+// few instructions and the percentiles come out to within a factor of two
+// a probe is only written by the task it is in, readers on the other core may see a count that is one behind
+#define PROFILE_BUCKETS 16              // the last one is 32mS and over
+class CProfiler {
+public:
+    struct PROBE {
+        const char* name;
+        uint32_t count;
+        uint32_t maxUs;
+        uint64_t totalUs;
+        uint32_t buckets[PROFILE_BUCKETS];  // bucket n is 2^n to 2^(n+1)-1 uS, bucket 0 includes 0
+    };
+private:
+    PROBE* m_pProbes;
+    int m_nProbes;
+    uint32_t m_nCyclesPerUs = 240;
+public:
+    CProfiler(PROBE* probes, int count) : m_pProbes(probes), m_nProbes(count)
+    {
+    }
+    void begin()
+    {
+        m_nCyclesPerUs = max((uint32_t)1, (uint32_t)ESP.getCpuFreqMHz());
+        reset();
+    }
+    void reset()
+    {
+        for (int ix = 0; ix < m_nProbes; ++ix) {
+            const char* name = m_pProbes[ix].name;
+            memset(&m_pProbes[ix], 0, sizeof(PROBE));
+            m_pProbes[ix].name = name;
+        }
+    }
+    static int Bucket(uint32_t us)
+    {
+        if (us < 2)
+            return 0;
+        return min(PROFILE_BUCKETS - 1, 31 - __builtin_clz(us));
+    }
+    // add a time in microseconds
+    void addUs(int probe, uint32_t us)
+    {
+        PROBE& p = m_pProbes[probe];
+        ++p.count;
+        p.totalUs += us;
+        if (us > p.maxUs)
+            p.maxUs = us;
+        ++p.buckets[Bucket(us)];
+    }
+    // add a time measured with ESP.getCycleCount()
+    void addCycles(int probe, uint32_t cycles)
+    {
+        addUs(probe, cycles / m_nCyclesPerUs);
+    }
+    int count()
+    {
+        return m_nProbes;
+    }
+    const PROBE& probe(int probe)
+    {
+        return m_pProbes[probe];
+    }
+    // the top of the bucket that the percentile falls in, in microseconds
+    uint32_t percentile(int probe, int percent)
+    {
+        const PROBE& p = m_pProbes[probe];
+        uint32_t target = (uint32_t)(((uint64_t)p.count * percent + 99) / 100);
+        uint32_t seen = 0;
+        for (int ix = 0; ix < PROFILE_BUCKETS; ++ix) {
+            seen += p.buckets[ix];
+            if (seen >= target && seen)
+                return ix == PROFILE_BUCKETS - 1 ? p.maxUs : min(p.maxUs, (uint32_t)((2UL << ix) - 1));
+        }
+        return p.maxUs;
+    }
+    // print a table with the histograms
+    void print(Print& out)
+    {
+        out.println("probe,count,avg,p50,p99,max (uS), then counts for <2,<4,<8 ... uS");
+        for (int ix = 0; ix < m_nProbes; ++ix) {
+            const PROBE& p = m_pProbes[ix];
+            out.printf("%s,%lu,%lu,%lu,%lu,%lu", p.name, (unsigned long)p.count, (unsigned long)(p.count ? p.totalUs / p.count : 0),
+                (unsigned long)percentile(ix, 50), (unsigned long)percentile(ix, 99), (unsigned long)p.maxUs);
+            for (int bucket = 0; bucket < PROFILE_BUCKETS; ++bucket)
+                out.printf(",%lu", (unsigned long)p.buckets[bucket]);
+            out.println();
+        }
+    }
+};
+
+// times the rest of the block it is in
+class CProfileScope {
+private:
+    CProfiler& m_profiler;
+    int m_nProbe;
+    uint32_t m_nStart;
+public:
+    CProfileScope(CProfiler& profiler, int probe) : m_profiler(profiler), m_nProbe(probe), m_nStart(ESP.getCycleCount())
+    {
+    }
+    ~CProfileScope()
+    {
+        m_profiler.addCycles(m_nProbe, ESP.getCycleCount() - m_nStart);
+    }
+};
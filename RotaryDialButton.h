@@ -31,6 +31,10 @@ private:
     static esp_timer_create_args_t periodic_LONGPRESS_timer_args;
 	static gpio_num_t gpioA, gpioB, gpioC, gpioBtn0, gpioBtn1, gpioAltLeft, gpioAltRight;
     static std::queue<Button> btnBuf;
+    // esp_timer_get_time() for each button in btnBuf, for the input latency
+    static std::queue<int64_t> timeBuf;
+    static volatile int64_t m_nEdgeTime;   // when the click interrupt started the timer
+    static int64_t m_nLastTime;            // the time for the last button from dequeue()
     static const int m_nMaxButtons = 10;
     static volatile int m_nWaitRelease;    // this counts waits after a long press for release
 #define CLICK_BUTTONS_COUNT 5
@@ -44,6 +48,12 @@ private:
     // Private constructor so that no objects can be created.
     CRotaryDialButton() {
     }
+    // add a button and when it happened, the caller checks there is room
+    static void push(Button btn, int64_t time)
+    {
+        btnBuf.push(btn);
+        timeBuf.push(time);
+    }
     // the timer callback for handling long presses
     static void periodic_Button_timer_callback(void* arg)
     {
@@ -123,7 +133,8 @@ private:
                 }
                 m_nWaitRelease = 20;
                 if (btnBuf.size() < m_nMaxButtons) {
-                    btnBuf.push(btn);
+                    // a long press happens when it is seen, not when it was pushed
+                    push(btn, esp_timer_get_time());
                     m_nButtonTimer = -1;
                 }
                 // set it so we ignore the button interrupt for one more timer time
@@ -134,7 +145,7 @@ private:
                 if (m_nLongPressTimer > 0 && m_nLongPressTimer < pSettings->m_nLongPressTimerValue - 1) {
                     btn = clickBtnArray[m_nWhichButton];
                     if (btnBuf.size() < m_nMaxButtons) {
-                        btnBuf.push(btn);
+                        push(btn, m_nEdgeTime);
                         m_nLongPressTimer = 0;
                         m_nButtonTimer = -1;
                         m_nWaitRelease = 0;
@@ -175,6 +186,7 @@ private:
 		if (m_nWhichButton != -1 && m_nLongPressTimer == 0) {
 			m_nLongPressTimer = pSettings->m_nLongPressTimerValue * 10;
             m_nButtonTimer = 20; // wait 20 mS
+            m_nEdgeTime = esp_timer_get_time();
         }
         portEXIT_CRITICAL_ISR(&buttonMux);
     }
@@ -200,7 +212,8 @@ private:
             if (btnBuf.size() < m_nMaxButtons) {
                 // make sure we only count the pulses the user wants
                 if (--nPulseCount == 0) {
-					btnBuf.push(rotateCount > 0 ? BTN_RIGHT : BTN_LEFT);
+					// the encoder counts in hardware, so this is when we pulled it, not the edge
+					push(rotateCount > 0 ? BTN_RIGHT : BTN_LEFT, esp_timer_get_time());
                     nPulseCount = pSettings->m_nDialPulseCount;
                 }
             }
@@ -300,6 +313,8 @@ public:
         if (!btnBuf.empty()) {
             btn = btnBuf.front();
             btnBuf.pop();
+            m_nLastTime = timeBuf.front();
+            timeBuf.pop();
         }
         portEXIT_CRITICAL_ISR(&buttonMux);
         return btn;
@@ -328,6 +343,8 @@ public:
         portENTER_CRITICAL_ISR(&buttonMux);
         while (btnBuf.size())
             btnBuf.pop();
+        while (timeBuf.size())
+            timeBuf.pop();
         portEXIT_CRITICAL_ISR(&buttonMux);
     }
     // return the count
@@ -344,11 +361,19 @@ public:
     {
         portENTER_CRITICAL_ISR(&buttonMux);
         if (btnBuf.size() < m_nMaxButtons)
-			btnBuf.push(btn);
+			push(btn, esp_timer_get_time());
         portEXIT_CRITICAL_ISR(&buttonMux);
     }
+    // esp_timer_get_time() when the last button from dequeue() was pressed or turned
+    static int64_t lastTime()
+    {
+        return m_nLastTime;
+    }
 };
 std::queue<enum CRotaryDialButton::Button> CRotaryDialButton::btnBuf;
+std::queue<int64_t> CRotaryDialButton::timeBuf;
+volatile int64_t CRotaryDialButton::m_nEdgeTime = 0;
+int64_t CRotaryDialButton::m_nLastTime = 0;
 gpio_num_t CRotaryDialButton::gpioNums[CLICK_BUTTONS_COUNT] = { };
 gpio_num_t CRotaryDialButton::gpioA, CRotaryDialButton::gpioB, CRotaryDialButton::gpioC;
 gpio_num_t CRotaryDialButton::gpioBtn0, CRotaryDialButton::gpioBtn1;
@@ -0,0 +1,210 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+// binary streaming of the scale readings to a host over the serial port
+// this header has no Arduino dependencies so the host decoder (host/StreamDump.cpp) uses it too
+//
+// a frame is COBS encoded between 0 bytes, so a host can start listening anywhere, and anything else
+// printed on the port ends up between two 0s on its own and is thrown away when its CRC fails
+// the 0 at the start is sent with every frame, a host skips the empty frame between two 0s
+// decoded frame: type(1) sequence(2) payload(...) crc(2), all little endian
+// the CRC is CRC-16/CCITT-FALSE over type, sequence and payload
+// the sequence goes up by one for every frame sent, a gap means frames were dropped
+#define STREAM_VERSION 1
+#define STREAM_MAX_PAYLOAD 240
+#define STREAM_MAX_FRAME (STREAM_MAX_PAYLOAD + 5)
+#define STREAM_MAX_ENCODED (STREAM_MAX_FRAME + STREAM_MAX_FRAME / 254 + 2)
+// frame types
+// sent when a host subscribes: version(1) calFactor(float) tareOffset(4) sps(float)
+#define STREAM_HELLO 1
+// every conversion, batched: count(1) then count times: micros(4) counts(4) grams(float)
+// counts is the HX711 conversion before smoothing, tare and calibration, in the tare offset units
+#define STREAM_SAMPLES 2
+#define STREAM_SAMPLE_SIZE 12
+#define STREAM_MAX_SAMPLES ((STREAM_MAX_PAYLOAD - 1) / STREAM_SAMPLE_SIZE)
+// the status numbers: millis(4) grams(float) filament(4) percent(1) meters(float) rate(float) minutesLeft(4)
+#define STREAM_STATE 3
+// sent with the state when an alarm starts or stops: millis(4) loadcell(1) event(1) active(1) value(float)
+// the load cell is 1 based, the value is grams left for runout and g/min for the feed events
+#define STREAM_EVENT 4
+#define STREAM_EVENT_RUNOUT 1
+#define STREAM_EVENT_STALL 2            // the filament stopped coming off the spool
+#define STREAM_EVENT_TENSION 3          // something pulled hard on the spool
+// what a host can subscribe to
+#define STREAM_SUB_SAMPLES 0x01
+#define STREAM_SUB_STATE 0x02
+
+class CStreamFrame {
+private:
+    uint8_t m_frame[STREAM_MAX_FRAME];
+    int m_nLength = 0;                  // bytes in m_frame
+public:
+    static uint16_t Crc16(const uint8_t* data, int length)
+    {
+        uint16_t crc = 0xffff;
+        while (length--) {
+            crc ^= (uint16_t)*data++ << 8;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        return crc;
+    }
+    // COBS encode into out, with the 0 at the end, returns the length
+    static int Encode(const uint8_t* data, int length, uint8_t* out)
+    {
+        int code = 0, outLen = 1;
+        uint8_t count = 1;
+        for (int ix = 0; ix < length; ++ix) {
+            if (data[ix]) {
+                out[outLen++] = data[ix];
+                ++count;
+            }
+            if (!data[ix] || count == 0xff) {
+                out[code] = count;
+                code = outLen++;
+                count = 1;
+            }
+        }
+        out[code] = count;
+        out[outLen++] = 0;
+        return outLen;
+    }
+    // COBS decode without the 0 at the end, returns the length or -1 if it is bad
+    static int Decode(const uint8_t* data, int length, uint8_t* out)
+    {
+        int outLen = 0;
+        for (int ix = 0; ix < length;) {
+            uint8_t code = data[ix++];
+            if (code == 0 || ix + code - 1 > length)
+                return -1;
+            for (int run = 1; run < code; ++run)
+                out[outLen++] = data[ix++];
+            if (code != 0xff && ix < length)
+                out[outLen++] = 0;
+        }
+        return outLen;
+    }
+    // start a new frame
+    void begin(uint8_t type, uint16_t sequence)
+    {
+        m_nLength = 0;
+        put8(type);
+        put16(sequence);
+    }
+    // bytes left for the payload
+    int room()
+    {
+        return STREAM_MAX_FRAME - 2 - m_nLength;
+    }
+    void put8(uint8_t value)
+    {
+        m_frame[m_nLength++] = value;
+    }
+    void put16(uint16_t value)
+    {
+        put8((uint8_t)value);
+        put8((uint8_t)(value >> 8));
+    }
+    void put32(uint32_t value)
+    {
+        put16((uint16_t)value);
+        put16((uint16_t)(value >> 16));
+    }
+    void putFloat(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        put32(bits);
+    }
+    // change a byte already in the payload, like a count
+    void set8(int offset, uint8_t value)
+    {
+        m_frame[3 + offset] = value;
+    }
+    // add the CRC and COBS encode it into out, which needs STREAM_MAX_ENCODED bytes, returns the length
+    int finish(uint8_t* out)
+    {
+        uint16_t crc = Crc16(m_frame, m_nLength);
+        put16(crc);
+        int length = Encode(m_frame, m_nLength, out);
+        m_nLength -= 2;
+        return length;
+    }
+};
+
+// the host side, feed it bytes and it says when there is a good frame
+class CStreamDecoder {
+private:
+    uint8_t m_raw[STREAM_MAX_ENCODED];
+    int m_nRaw = 0;
+    bool m_bOverflow = false;
+    uint8_t m_frame[STREAM_MAX_ENCODED];
+    int m_nLength = 0;
+    bool m_bHaveSequence = false;
+    uint16_t m_nNextSequence = 0;
+public:
+    unsigned long frames = 0;           // good frames
+    unsigned long badFrames = 0;        // bad CRC or encoding, or too long
+    unsigned long lostFrames = 0;       // counted from gaps in the sequence
+
+    static uint16_t Get16(const uint8_t* p)
+    {
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
+    static uint32_t Get32(const uint8_t* p)
+    {
+        return Get16(p) | ((uint32_t)Get16(p + 2) << 16);
+    }
+    static float GetFloat(const uint8_t* p)
+    {
+        uint32_t bits = Get32(p);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    // returns true when b finishes a good frame
+    bool feed(uint8_t b)
+    {
+        if (b != 0) {
+            if (m_nRaw < (int)sizeof(m_raw))
+                m_raw[m_nRaw++] = b;
+            else
+                m_bOverflow = true;
+            return false;
+        }
+        int raw = m_nRaw;
+        bool overflow = m_bOverflow;
+        m_nRaw = 0;
+        m_bOverflow = false;
+        if (raw == 0)
+            return false;
+        m_nLength = overflow ? -1 : CStreamFrame::Decode(m_raw, raw, m_frame);
+        if (m_nLength < 5 || CStreamFrame::Crc16(m_frame, m_nLength - 2) != Get16(m_frame + m_nLength - 2)) {
+            ++badFrames;
+            return false;
+        }
+        uint16_t seq = sequence();
+        if (m_bHaveSequence)
+            lostFrames += (uint16_t)(seq - m_nNextSequence);
+        m_nNextSequence = seq + 1;
+        m_bHaveSequence = true;
+        ++frames;
+        return true;
+    }
+    uint8_t type()
+    {
+        return m_frame[0];
+    }
+    uint16_t sequence()
+    {
+        return Get16(m_frame + 1);
+    }
+    const uint8_t* payload()
+    {
+        return m_frame + 3;
+    }
+    int payloadLength()
+    {
+        return m_nLength - 5;
+    }
+};
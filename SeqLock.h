@@ -0,0 +1,37 @@
+#pragma once
+// a value written by one task and read by any number of others without locking
+// the writer makes the sequence odd while it copies the value in and even again after,
+// a reader copies the value out and tries again if the sequence was odd or changed while it did
+// readers never hold up the writer, so a slow reader can't delay sampling
+template <typename T>
+class CSeqLock {
+private:
+    volatile uint32_t m_nSequence = 0;
+    T m_value;
+public:
+    // only one task may write
+    void write(const T& value)
+    {
+        m_nSequence = m_nSequence + 1;
+        __sync_synchronize();
+        m_value = value;
+        __sync_synchronize();
+        m_nSequence = m_nSequence + 1;
+    }
+    // copy the latest value
+    void read(T& value)
+    {
+        uint32_t sequence;
+        do {
+            sequence = m_nSequence;
+            __sync_synchronize();
+            value = m_value;
+            __sync_synchronize();
+        } while ((sequence & 1) || sequence != m_nSequence);
+    }
+    // goes up by two for every write
+    uint32_t sequence()
+    {
+        return m_nSequence;
+    }
+};
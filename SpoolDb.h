@@ -0,0 +1,207 @@
+#pragma once
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <algorithm>
+// the spools, each one has its empty weight, the filament on it when full, and the filament density and diameter
+// a record is six uint16 fields, so a thousand spools is a 12K file on the log file system
+// the spool number is the index, and the length conversion is worked out when the density or diameter
+// change, so turning grams into meters for the display is one multiply
+// the spools are also kept in order of what they should weigh, the empty spool and the filament that was
+// last seen on it, so a weight on the scale can be matched without looking at all of them
+// spools without an empty weight haven't been set up, so they are left out of it
+#define MAX_SPOOLS 1000
+#define SPOOLDB_FILE "/spools.bin"
+#define SPOOLDB_VERSION 1
+#define SPOOL_DENSITY_PLA 1240          // mg/cm3
+#define SPOOL_DIAMETER_175 175          // 1/100 mm
+#define SPOOL_NET_GRAMS 1000            // filament on a new spool
+class CSpoolDb {
+public:
+    struct SPOOLRECORD {
+        uint16_t emptyGrams;            // the empty spool
+        uint16_t netGrams;              // filament on a full spool, never 0
+        uint16_t density;               // mg/cm3, PLA is 1240
+        uint16_t diameter;              // 1/100 mm, 175 or 285
+        uint16_t lengthConversion;      // meters per kg with 2 decimals, from the density and diameter
+        uint16_t remainingGrams;        // the filament the last time the spool was on the scale
+    };
+    struct SPOOLMATCH {
+        int spool;
+        int error;                      // grams away from what the spool should weigh, always positive
+    };
+private:
+    SPOOLRECORD m_spools[MAX_SPOOLS];
+    bool m_bDirty = false;
+    // spool numbers in order of expected weight, and where each spool is in it, -1 if it isn't
+    uint16_t m_index[MAX_SPOOLS];
+    int16_t m_position[MAX_SPOOLS];
+    int m_nIndexed = 0;
+    int expected(int spool)
+    {
+        return m_spools[spool - 1].emptyGrams + m_spools[spool - 1].remainingGrams;
+    }
+    // move a spool whose weight changed to its new place, it is usually only a gram or two so it doesn't go far
+    // one that was just set up starts at the end, and one that isn't any more comes out
+    void reindex(int spool)
+    {
+        int pos = m_position[spool - 1];
+        if (m_spools[spool - 1].emptyGrams == 0) {
+            if (pos < 0)
+                return;
+            for (--m_nIndexed; pos < m_nIndexed; ++pos) {
+                m_index[pos] = m_index[pos + 1];
+                m_position[m_index[pos] - 1] = pos;
+            }
+            m_position[spool - 1] = -1;
+            return;
+        }
+        if (pos < 0)
+            pos = m_nIndexed++;
+        int weight = expected(spool);
+        for (; pos > 0 && expected(m_index[pos - 1]) > weight; --pos) {
+            m_index[pos] = m_index[pos - 1];
+            m_position[m_index[pos] - 1] = pos;
+        }
+        for (; pos < m_nIndexed - 1 && expected(m_index[pos + 1]) < weight; ++pos) {
+            m_index[pos] = m_index[pos + 1];
+            m_position[m_index[pos] - 1] = pos;
+        }
+        m_index[pos] = spool;
+        m_position[spool - 1] = pos;
+    }
+    void buildIndex()
+    {
+        m_nIndexed = 0;
+        for (int ix = 0; ix < MAX_SPOOLS; ++ix) {
+            m_position[ix] = -1;
+            if (m_spools[ix].emptyGrams != 0)
+                m_index[m_nIndexed++] = ix + 1;
+        }
+        std::sort(m_index, m_index + m_nIndexed, [this](uint16_t a, uint16_t b) { return expected(a) < expected(b); });
+        for (int ix = 0; ix < m_nIndexed; ++ix)
+            m_position[m_index[ix] - 1] = ix;
+    }
+public:
+    CSpoolDb()
+    {
+        memset(m_spools, 0, sizeof(m_spools));
+        buildIndex();
+    }
+    // meters per kg with 2 decimals, that is cm per kg
+    static uint16_t LengthConversion(int density, int diameter)
+    {
+        float radius = diameter / 2000.0;           // cm
+        float gramsPerCm = density / 1000.0 * PI * radius * radius;
+        return constrain(lround(1000.0 / gramsPerCm), 1, 65535);
+    }
+    // spools are 1 based
+    const SPOOLRECORD& spool(int spool)
+    {
+        return m_spools[constrain(spool, 1, MAX_SPOOLS) - 1];
+    }
+    void setEmpty(int spool, int grams)
+    {
+        m_spools[spool - 1].emptyGrams = constrain(grams, 0, 65535);
+        reindex(spool);
+        m_bDirty = true;
+    }
+    // the filament seen on the spool, it is only written when it changes since this follows the scale
+    void setRemaining(int spool, int grams)
+    {
+        grams = constrain(grams, 0, 65535);
+        if (m_spools[spool - 1].remainingGrams == grams)
+            return;
+        m_spools[spool - 1].remainingGrams = grams;
+        reindex(spool);
+        m_bDirty = true;
+    }
+    // the spools that could be what is on the scale, closest first
+    // a binary search finds where the weight goes in the index and the closest ones are on either side of it
+    int match(float grams, int tolerance, SPOOLMATCH* matches, int max)
+    {
+        int weight = lround(grams);
+        int above = std::lower_bound(m_index, m_index + m_nIndexed, weight, [this](uint16_t spool, int weight) { return expected(spool) < weight; }) - m_index;
+        int below = above - 1;
+        int count = 0;
+        while (count < max && (below >= 0 || above < m_nIndexed)) {
+            int errorBelow = below >= 0 ? weight - expected(m_index[below]) : INT_MAX;
+            int errorAbove = above < m_nIndexed ? expected(m_index[above]) - weight : INT_MAX;
+            int spool;
+            int error;
+            if (errorBelow <= errorAbove) {
+                spool = m_index[below--];
+                error = errorBelow;
+            }
+            else {
+                spool = m_index[above++];
+                error = errorAbove;
+            }
+            if (error > tolerance)
+                break;
+            matches[count].spool = spool;
+            matches[count].error = error;
+            ++count;
+        }
+        return count;
+    }
+    void setNet(int spool, int grams)
+    {
+        m_spools[spool - 1].netGrams = constrain(grams, 1, 65535);
+        m_bDirty = true;
+    }
+    void setMaterial(int spool, int density, int diameter)
+    {
+        SPOOLRECORD& record = m_spools[spool - 1];
+        record.density = constrain(density, 100, 65535);
+        record.diameter = constrain(diameter, 10, 1000);
+        record.lengthConversion = LengthConversion(record.density, record.diameter);
+        m_bDirty = true;
+    }
+    // the spools before there was a database only had an empty weight, the rest was the same for all of them
+    void migrate(const int* emptyGrams, int count, int netGrams, long lengthConversion)
+    {
+        for (int ix = 0; ix < MAX_SPOOLS; ++ix) {
+            setMaterial(ix + 1, SPOOL_DENSITY_PLA, SPOOL_DIAMETER_175);
+            setNet(ix + 1, ix < count ? netGrams : SPOOL_NET_GRAMS);
+            setEmpty(ix + 1, ix < count ? emptyGrams[ix] : 0);
+            // we don't know what is on them, so they are full
+            setRemaining(ix + 1, m_spools[ix].netGrams);
+            // keep the conversion that was set up for them
+            if (ix < count)
+                m_spools[ix].lengthConversion = constrain(lengthConversion, 1, 65535);
+        }
+    }
+    // write the file if something changed since the last save
+    void flush()
+    {
+        if (m_bDirty)
+            save();
+    }
+    bool save()
+    {
+        File file = LittleFS.open(SPOOLDB_FILE, "w");
+        if (!file)
+            return false;
+        uint32_t version = SPOOLDB_VERSION;
+        file.write((uint8_t*)&version, sizeof(version));
+        bool ok = file.write((uint8_t*)m_spools, sizeof(m_spools)) == sizeof(m_spools);
+        file.close();
+        if (ok)
+            m_bDirty = false;
+        return ok;
+    }
+    // false if there isn't a good file, then migrate() should be used
+    bool load()
+    {
+        File file = LittleFS.open(SPOOLDB_FILE, "r");
+        if (!file)
+            return false;
+        uint32_t version = 0;
+        bool ok = file.read((uint8_t*)&version, sizeof(version)) == sizeof(version) && version == SPOOLDB_VERSION
+            && file.read((uint8_t*)m_spools, sizeof(m_spools)) == sizeof(m_spools);
+        file.close();
+        m_bDirty = false;
+        buildIndex();
+        return ok;
+    }
+};
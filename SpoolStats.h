@@ -0,0 +1,243 @@
+#pragma once
+#include <LittleFS.h>
+// filament used by each spool kept in round robin tiers, like RRD
+// per minute for a day, per hour for a month, and per day for a year
+// every sample adds to all three tiers and each tier keeps a running total, so the usage over a
+// whole tier is one read, and the week is a running total over the last seven days
+// there are slots for a few spools, when a new spool is used the least recently used slot is taken
+// each load cell measures the usage of its own spool, so there is a slot for each one and a few spare
+#define STATS_SPARE_SPOOLS 3
+#define STATS_MINUTES 1440              // a day of minutes
+#define STATS_HOURS 720                 // a month of hours
+#define STATS_DAYS 365                  // a year of days
+#define STATS_MIN_STEP 10               // decigrams, the weight has to drop this much to count as used
+#define STATS_MAX_STEP 1000             // decigrams, a bigger drop is a spool being removed, not used
+#define STATS_SAVE_MINUTES 60           // save this often when something changed
+#define STATS_FILE "/spoolstats.bin"
+#define STATS_VERSION 1
+template <int CHANNELS>
+class CSpoolStats {
+public:
+    enum Period { LAST_DAY = 0, LAST_WEEK, LAST_MONTH, LAST_YEAR };
+    static const int SPOOLS = CHANNELS + STATS_SPARE_SPOOLS;
+private:
+    struct SPOOLSTATS {
+        int16_t spool;                  // 1 based spool number, 0 if the slot is free
+        uint32_t lastMinute;            // the last minute the tiers were moved up to
+        uint32_t dayTotal, weekTotal, monthTotal, yearTotal;    // decigrams
+        uint16_t minutes[STATS_MINUTES];    // decigrams used in each slot
+        uint16_t hours[STATS_HOURS];
+        uint16_t days[STATS_DAYS];
+    };
+    SPOOLSTATS m_stats[SPOOLS];
+    // the clock, minutes since boot are moved to carry on from the saved stats
+    uint32_t m_nMinuteOffset = 0;
+    uint32_t m_nNow = 0;                // current minute on the stats clock
+    // the weight that usage is measured down from on each load cell
+    struct REFERENCE {
+        int slot;                       // the spool it is for, -1 if none
+        int32_t decigrams;
+        bool bValid;
+    };
+    REFERENCE m_reference[CHANNELS];
+    bool m_bDirty = false;
+    uint32_t m_nSaveMinute = 0;         // when the file was last written
+
+    static void AddSaturate(uint16_t& slot, uint32_t amount)
+    {
+        slot = (uint16_t)min((uint32_t)UINT16_MAX, slot + amount);
+    }
+    // move a spool's tiers up to the current minute, clearing the slots that are reused
+    void Advance(SPOOLSTATS& st)
+    {
+        if (m_nNow <= st.lastMinute)
+            return;
+        if (m_nNow - st.lastMinute >= STATS_DAYS * 1440UL) {
+            // not used for a year, everything goes
+            int16_t spool = st.spool;
+            memset(&st, 0, sizeof(SPOOLSTATS));
+            st.spool = spool;
+            st.lastMinute = m_nNow;
+            return;
+        }
+        for (uint32_t minute = st.lastMinute + 1; minute <= m_nNow; ++minute) {
+            if (m_nNow - minute < STATS_MINUTES) {
+                uint16_t& slot = st.minutes[minute % STATS_MINUTES];
+                st.dayTotal -= slot;
+                slot = 0;
+            }
+            if (minute % 60 == 0 && (m_nNow - minute) / 60 < STATS_HOURS) {
+                uint16_t& slot = st.hours[(minute / 60) % STATS_HOURS];
+                st.monthTotal -= slot;
+                slot = 0;
+            }
+            if (minute % 1440 == 0) {
+                uint32_t day = minute / 1440;
+                // the day leaving the week is still in the year
+                st.weekTotal -= st.days[(day + STATS_DAYS - 7) % STATS_DAYS];
+                uint16_t& slot = st.days[day % STATS_DAYS];
+                st.yearTotal -= slot;
+                slot = 0;
+            }
+        }
+        st.lastMinute = m_nNow;
+    }
+    void ClearReferences()
+    {
+        for (REFERENCE& ref : m_reference) {
+            ref.slot = -1;
+            ref.bValid = false;
+        }
+    }
+    // true if another load cell is measuring the spool in the slot
+    bool InUse(int slot, int channel)
+    {
+        for (int ch = 0; ch < CHANNELS; ++ch) {
+            if (ch != channel && m_reference[ch].slot == slot)
+                return true;
+        }
+        return false;
+    }
+    int FindSlot(int spool)
+    {
+        for (int ix = 0; ix < SPOOLS; ++ix) {
+            if (m_stats[ix].spool == spool)
+                return ix;
+        }
+        return -1;
+    }
+    // find the spool's slot or take over the one used longest ago that no other load cell is measuring,
+    // there is always one since there are more slots than load cells
+    int UseSlot(int spool, int channel)
+    {
+        int slot = FindSlot(spool);
+        if (slot != -1)
+            return slot;
+        slot = -1;
+        for (int ix = 0; ix < SPOOLS; ++ix) {
+            if (InUse(ix, channel))
+                continue;
+            if (slot == -1 || m_stats[ix].spool == 0 || (m_stats[slot].spool != 0 && m_stats[ix].lastMinute < m_stats[slot].lastMinute))
+                slot = ix;
+        }
+        memset(&m_stats[slot], 0, sizeof(SPOOLSTATS));
+        m_stats[slot].spool = spool;
+        m_stats[slot].lastMinute = m_nNow;
+        return slot;
+    }
+    // set the stats clock from time(NULL)
+    void SetClock(time_t time)
+    {
+        uint32_t minute = (uint32_t)(time / 60);
+        uint32_t last = 0;
+        for (int ix = 0; ix < SPOOLS; ++ix)
+            last = max(last, m_stats[ix].lastMinute);
+        // after a restart the clock starts over, and when it gets set it jumps, carry on from where we were
+        if (minute + m_nMinuteOffset < last || minute + m_nMinuteOffset > last + (STATS_DAYS + 1) * 1440UL) {
+            m_nMinuteOffset = last - minute;
+        }
+        m_nNow = minute + m_nMinuteOffset;
+    }
+public:
+    CSpoolStats()
+    {
+        memset(m_stats, 0, sizeof(m_stats));
+        ClearReferences();
+    }
+    // add a filament weight sample for the spool on a load cell
+    void add(int channel, time_t time, int spool, int32_t decigrams)
+    {
+        SetClock(time);
+        int slot = UseSlot(spool, channel);
+        SPOOLSTATS& st = m_stats[slot];
+        Advance(st);
+        REFERENCE& ref = m_reference[channel];
+        if (slot != ref.slot) {
+            // different spool, start measuring from here
+            ref.slot = slot;
+            ref.bValid = false;
+        }
+        if (!ref.bValid || decigrams > ref.decigrams + STATS_MAX_STEP || ref.decigrams - decigrams > STATS_MAX_STEP) {
+            // a spool was put on or taken off
+            ref.decigrams = decigrams;
+            ref.bValid = true;
+            return;
+        }
+        int32_t used = ref.decigrams - decigrams;
+        if (used < STATS_MIN_STEP)
+            return;
+        ref.decigrams = decigrams;
+        AddSaturate(st.minutes[m_nNow % STATS_MINUTES], used);
+        AddSaturate(st.hours[(m_nNow / 60) % STATS_HOURS], used);
+        AddSaturate(st.days[(m_nNow / 1440) % STATS_DAYS], used);
+        st.dayTotal += used;
+        st.weekTotal += used;
+        st.monthTotal += used;
+        st.yearTotal += used;
+        m_bDirty = true;
+        if (m_nNow - m_nSaveMinute >= STATS_SAVE_MINUTES) {
+            save();
+        }
+    }
+    // decigrams used by a spool over the period, 0 if we don't have the spool
+    uint32_t used(time_t time, int spool, Period period)
+    {
+        int slot = FindSlot(spool);
+        if (slot == -1)
+            return 0;
+        SetClock(time);
+        Advance(m_stats[slot]);
+        switch (period) {
+        case LAST_DAY:
+            return m_stats[slot].dayTotal;
+        case LAST_WEEK:
+            return m_stats[slot].weekTotal;
+        case LAST_MONTH:
+            return m_stats[slot].monthTotal;
+        case LAST_YEAR:
+            return m_stats[slot].yearTotal;
+        }
+        return 0;
+    }
+    // write the file if something changed since the last save
+    void flush()
+    {
+        if (m_bDirty)
+            save();
+    }
+    // the stats live in their own file next to the settings
+    bool save()
+    {
+        File file = LittleFS.open(STATS_FILE, "w");
+        if (!file)
+            return false;
+        uint32_t version = STATS_VERSION;
+        file.write((uint8_t*)&version, sizeof(version));
+        bool ok = file.write((uint8_t*)m_stats, sizeof(m_stats)) == sizeof(m_stats);
+        file.close();
+        if (ok)
+            m_bDirty = false;
+        m_nSaveMinute = m_nNow;
+        return ok;
+    }
+    bool load()
+    {
+        File file = LittleFS.open(STATS_FILE, "r");
+        if (!file)
+            return false;
+        uint32_t version = 0;
+        // a file from a build with a different number of load cells has a different number of slots
+        bool ok = file.size() == sizeof(version) + sizeof(m_stats)
+            && file.read((uint8_t*)&version, sizeof(version)) == sizeof(version) && version == STATS_VERSION
+            && file.read((uint8_t*)m_stats, sizeof(m_stats)) == sizeof(m_stats);
+        file.close();
+        if (!ok)
+            memset(m_stats, 0, sizeof(m_stats));
+        ClearReferences();
+        m_bDirty = false;
+        m_nMinuteOffset = 0;
+        SetClock(time(NULL));
+        m_nSaveMinute = m_nNow;
+        return ok;
+    }
+};
@@ -0,0 +1,456 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+// telemetry for a dashboard, the scale state as small JSON messages published to an MQTT broker and sent to
+// WebSocket clients, the same message goes to both
+// the MQTT and WebSocket code is templated on the socket classes, so a host build can run it against a local
+// mosquitto or a loopback socket, this header has no Arduino dependencies, host/TelemetryTest.cpp does that
+//
+// messages, the MQTT topic is <prefix>/<load cell>/<kind> and the kind and load cell are in the message too:
+//   state    {"c":1,"k":"state","w":grams,"f":filament,"p":percent,"m":meters,"r":g/min,"l":minutes left,"s":stable,"a":alarms}
+//            only sent when something changed by more than its deadband, at most once a second while the weight
+//            is moving and once every 30 seconds while it is stable, a stability or alarm change goes at once,
+//            and when nothing changes there is a heartbeat every minute
+//   samples  {"c":1,"k":"samples","t":millis of the first,"dt":mS apart,"d":[decigrams...]}
+//            the weights while it is moving, batched, nothing is sent while it is stable
+#define TELEMETRY_MOVING_MS 1000        // the state goes no more often than this while the weight moves
+#define TELEMETRY_STABLE_MS 30000       // and this while it is stable
+#define TELEMETRY_HEARTBEAT_MS 60000    // and at least this often
+#define TELEMETRY_GRAMS 0.5             // the weight has to change this much
+#define TELEMETRY_RATE 0.1              // g/min
+#define TELEMETRY_MAX_SAMPLES 40        // in a samples message
+#define TELEMETRY_BATCH_MS 1000         // the oldest sample waits no longer than this
+#define TELEMETRY_MAX_PAYLOAD 400
+// alarm bits in "a"
+#define TELEMETRY_ALARM_RUNOUT 0x01
+#define TELEMETRY_ALARM_STALL 0x02
+#define TELEMETRY_ALARM_TENSION 0x04
+
+// what is sent for a load cell
+struct TELEMETRYSTATE {
+    float weight;
+    int filamentWeight;
+    int percent;
+    float length;
+    float rate;                         // 0 if there isn't one yet
+    int minutesLeft;                    // -1 if not using any
+    bool bStable;
+    uint8_t alarms;
+};
+
+// decides when to send, and makes the messages, for one load cell
+class CTelemetryChannel {
+private:
+    int m_nChannel;                     // 1 based
+    TELEMETRYSTATE m_sent;
+    bool m_bSent = false;
+    uint32_t m_nSentMs = 0;
+    int32_t m_samples[TELEMETRY_MAX_SAMPLES];
+    int m_nSamples = 0;
+    uint32_t m_nFirstMs = 0, m_nLastMs = 0;
+public:
+    void begin(int channel)
+    {
+        m_nChannel = channel;
+    }
+    // true when the state has changed enough to send, or it is time for the heartbeat
+    bool stateDue(const TELEMETRYSTATE& state, uint32_t ms)
+    {
+        if (!m_bSent || state.bStable != m_sent.bStable || state.alarms != m_sent.alarms)
+            return true;
+        uint32_t elapsed = ms - m_nSentMs;
+        if (elapsed >= TELEMETRY_HEARTBEAT_MS)
+            return true;
+        bool bChanged = fabsf(state.weight - m_sent.weight) >= TELEMETRY_GRAMS || state.filamentWeight != m_sent.filamentWeight
+            || state.percent != m_sent.percent || fabsf(state.rate - m_sent.rate) >= TELEMETRY_RATE || state.minutesLeft != m_sent.minutesLeft;
+        return bChanged && elapsed >= (uint32_t)(state.bStable ? TELEMETRY_STABLE_MS : TELEMETRY_MOVING_MS);
+    }
+    // send the state next time whatever it is, for a new listener
+    void resend()
+    {
+        m_bSent = false;
+    }
+    // the state message, call when it has been sent so the next one is measured from it
+    int formatState(const TELEMETRYSTATE& state, uint32_t ms, char* out, int size)
+    {
+        m_sent = state;
+        m_bSent = true;
+        m_nSentMs = ms;
+        int length = snprintf(out, size, "{\"c\":%d,\"k\":\"state\",\"w\":%.1f,\"f\":%d,\"p\":%d,\"m\":%.1f,\"r\":%.2f,\"l\":%d,\"s\":%d,\"a\":%u}",
+            m_nChannel, state.weight, state.filamentWeight, state.percent, state.length, state.rate, state.minutesLeft, state.bStable, state.alarms);
+        return length < size ? length : size - 1;
+    }
+    // add a weight while it is moving, returns true when the batch is full
+    bool addSample(float grams, uint32_t ms)
+    {
+        if (m_nSamples == 0)
+            m_nFirstMs = ms;
+        m_nLastMs = ms;
+        m_samples[m_nSamples++] = (int32_t)lroundf(grams * 10);
+        return m_nSamples == TELEMETRY_MAX_SAMPLES;
+    }
+    int samples()
+    {
+        return m_nSamples;
+    }
+    // true when the oldest sample has waited long enough
+    bool samplesDue(uint32_t ms)
+    {
+        return m_nSamples && ms - m_nFirstMs >= TELEMETRY_BATCH_MS;
+    }
+    // the samples message, this empties the batch
+    int formatSamples(char* out, int size)
+    {
+        uint32_t dt = m_nSamples > 1 ? (m_nLastMs - m_nFirstMs) / (m_nSamples - 1) : 0;
+        int length = snprintf(out, size, "{\"c\":%d,\"k\":\"samples\",\"t\":%lu,\"dt\":%lu,\"d\":[", m_nChannel, (unsigned long)m_nFirstMs, (unsigned long)dt);
+        for (int ix = 0; ix < m_nSamples && length < size; ++ix)
+            length += snprintf(out + length, size - length, ix ? ",%ld" : "%ld", (long)m_samples[ix]);
+        if (length < size)
+            length += snprintf(out + length, size - length, "]}");
+        m_nSamples = 0;
+        return length < size ? length : size - 1;
+    }
+};
+
+// MQTT 3.1.1, just enough to publish at QoS 0 and keep the connection alive
+// ClientT is a connected stream socket with write(), read(), available(), connected() and stop(), like WiFiClient
+// nothing here waits, begin() sends CONNECT and service() picks up the CONNACK and sends the pings
+#define MQTT_KEEPALIVE_SECONDS 60
+#define MQTT_CONNACK_MS 5000            // the broker has this long to answer
+template <class ClientT>
+class CMqttClient {
+public:
+    enum State { DISCONNECTED, CONNECTING, CONNECTED };
+private:
+    ClientT& m_client;
+    State m_state = DISCONNECTED;
+    uint32_t m_nSentMs = 0;             // when the last packet went, for the keepalive
+    uint32_t m_nConnectMs = 0;
+    uint8_t m_header[5];
+    // the fixed header, the type and the remaining length
+    bool writeHeader(uint8_t type, uint32_t length)
+    {
+        int count = 0;
+        m_header[count++] = type;
+        do {
+            uint8_t digit = length % 128;
+            length /= 128;
+            m_header[count++] = digit | (length ? 0x80 : 0);
+        } while (length && count < 5);
+        return m_client.write(m_header, count) == (size_t)count;
+    }
+    bool writeString(const char* text)
+    {
+        uint16_t length = (uint16_t)strlen(text);
+        uint8_t size[2] = { (uint8_t)(length >> 8), (uint8_t)length };
+        return m_client.write(size, 2) == 2 && m_client.write((const uint8_t*)text, length) == length;
+    }
+public:
+    CMqttClient(ClientT& client) : m_client(client)
+    {
+    }
+    // the socket is already connected to the broker, ms is millis()
+    bool begin(const char* clientId, uint32_t ms)
+    {
+        static const uint8_t variable[] = { 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, MQTT_KEEPALIVE_SECONDS };  // clean session
+        bool ok = writeHeader(0x10, sizeof(variable) + 2 + strlen(clientId))
+            && m_client.write(variable, sizeof(variable)) == sizeof(variable) && writeString(clientId);
+        m_state = ok ? CONNECTING : DISCONNECTED;
+        m_nConnectMs = m_nSentMs = ms;
+        return ok;
+    }
+    State state()
+    {
+        return m_state;
+    }
+    bool connected()
+    {
+        return m_state == CONNECTED;
+    }
+    // QoS 0, so it is gone once it is written
+    bool publish(const char* topic, const char* payload, int length, bool retain, uint32_t ms)
+    {
+        if (m_state != CONNECTED)
+            return false;
+        bool ok = writeHeader(0x30 | (retain ? 1 : 0), 2 + strlen(topic) + length) && writeString(topic)
+            && m_client.write((const uint8_t*)payload, length) == (size_t)length;
+        if (!ok)
+            stop();
+        m_nSentMs = ms;
+        return ok;
+    }
+    // read what the broker sent and keep the connection alive, call this often
+    void service(uint32_t ms)
+    {
+        if (m_state == DISCONNECTED)
+            return;
+        if (!m_client.connected() || (m_state == CONNECTING && ms - m_nConnectMs > MQTT_CONNACK_MS)) {
+            stop();
+            return;
+        }
+        // the only thing that matters is the CONNACK, PINGRESP and anything else is thrown away
+        while (m_client.available() >= 4 && m_state == CONNECTING) {
+            uint8_t connack[4];
+            m_client.read(connack, 4);
+            if (connack[0] != 0x20 || connack[3] != 0) {
+                stop();
+                return;
+            }
+            m_state = CONNECTED;
+        }
+        while (m_state == CONNECTED && m_client.available())
+            m_client.read();
+        if (m_state == CONNECTED && ms - m_nSentMs >= MQTT_KEEPALIVE_SECONDS * 1000UL / 2) {
+            writeHeader(0xc0, 0);
+            m_nSentMs = ms;
+        }
+    }
+    void stop()
+    {
+        if (m_state == CONNECTED)
+            writeHeader(0xe0, 0);
+        m_client.stop();
+        m_state = DISCONNECTED;
+    }
+};
+
+// a WebSocket server that only sends, ServerT gives new ClientT connections from accept()
+// the browser's upgrade request is answered, then every message goes to every client as a text frame
+// what the clients send is thrown away, a client that closes or can't keep up is dropped
+#define WEBSOCKET_CLIENTS 2
+#define WEBSOCKET_REQUEST_MAX 512
+#define WEBSOCKET_HANDSHAKE_MS 2000
+template <class ServerT, class ClientT>
+class CWebSocketServer {
+private:
+    struct WSCLIENT {
+        ClientT client;
+        bool bOpen;                     // the handshake is done
+        int length;                     // of the request so far
+        uint32_t startMs;
+        char request[WEBSOCKET_REQUEST_MAX];
+        uint8_t frame[14];              // the header of the frame coming in
+        int frameLength;
+        uint64_t skip;                  // payload still to come, it is thrown away
+    };
+    ServerT& m_server;
+    WSCLIENT m_clients[WEBSOCKET_CLIENTS];
+    static uint32_t Rotate(uint32_t value, int bits)
+    {
+        return (value << bits) | (value >> (32 - bits));
+    }
+    // the handshake needs SHA-1, only for short strings here
+    static void Sha1(const uint8_t* data, int length, uint8_t* digest)
+    {
+        uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+        uint64_t bits = (uint64_t)length * 8;
+        int total = ((length + 8) / 64 + 1) * 64;
+        for (int block = 0; block < total; block += 64) {
+            uint32_t w[80];
+            for (int ix = 0; ix < 16; ++ix) {
+                w[ix] = 0;
+                for (int byte = 0; byte < 4; ++byte) {
+                    int pos = block + ix * 4 + byte;
+                    uint8_t value = pos < length ? data[pos] : pos == length ? 0x80 : pos >= total - 8 ? (uint8_t)(bits >> ((total - 1 - pos) * 8)) : 0;
+                    w[ix] = (w[ix] << 8) | value;
+                }
+            }
+            for (int ix = 16; ix < 80; ++ix)
+                w[ix] = Rotate(w[ix - 3] ^ w[ix - 8] ^ w[ix - 14] ^ w[ix - 16], 1);
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int ix = 0; ix < 80; ++ix) {
+                uint32_t f, k;
+                if (ix < 20) {
+                    f = (b & c) | (~b & d);
+                    k = 0x5a827999;
+                }
+                else if (ix < 40) {
+                    f = b ^ c ^ d;
+                    k = 0x6ed9eba1;
+                }
+                else if (ix < 60) {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8f1bbcdc;
+                }
+                else {
+                    f = b ^ c ^ d;
+                    k = 0xca62c1d6;
+                }
+                uint32_t temp = Rotate(a, 5) + f + e + k + w[ix];
+                e = d;
+                d = c;
+                c = Rotate(b, 30);
+                b = a;
+                a = temp;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+        }
+        for (int ix = 0; ix < 20; ++ix)
+            digest[ix] = (uint8_t)(h[ix / 4] >> (24 - (ix % 4) * 8));
+    }
+    static int Base64(const uint8_t* data, int length, char* out)
+    {
+        static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        int count = 0;
+        for (int ix = 0; ix < length; ix += 3) {
+            uint32_t value = (uint32_t)data[ix] << 16 | (ix + 1 < length ? data[ix + 1] << 8 : 0) | (ix + 2 < length ? data[ix + 2] : 0);
+            out[count++] = digits[(value >> 18) & 0x3f];
+            out[count++] = digits[(value >> 12) & 0x3f];
+            out[count++] = ix + 1 < length ? digits[(value >> 6) & 0x3f] : '=';
+            out[count++] = ix + 2 < length ? digits[value & 0x3f] : '=';
+        }
+        out[count] = 0;
+        return count;
+    }
+    // the header is 2 bytes, then a 16 or 64 bit length if the 7 bit one is 126 or 127, then the mask if there is one
+    static int FrameHeaderLength(const uint8_t* frame, int length)
+    {
+        if (length < 2)
+            return 2;
+        int size = frame[1] & 0x7f;
+        return 2 + (size == 126 ? 2 : size == 127 ? 8 : 0) + (frame[1] & 0x80 ? 4 : 0);
+    }
+    // read the frames from the browser and throw them away, returns false if it sent a close
+    bool readFrames(WSCLIENT& ws)
+    {
+        uint8_t discard[64];
+        while (ws.client.available()) {
+            if (ws.skip) {
+                int count = ws.client.read(discard, ws.skip < sizeof(discard) ? (size_t)ws.skip : sizeof(discard));
+                if (count <= 0)
+                    break;
+                ws.skip -= count;
+                continue;
+            }
+            ws.frame[ws.frameLength++] = ws.client.read();
+            if (ws.frameLength < FrameHeaderLength(ws.frame, ws.frameLength))
+                continue;
+            if ((ws.frame[0] & 0x0f) == 0x08)
+                return false;
+            int size = ws.frame[1] & 0x7f;
+            ws.skip = 0;
+            if (size < 126) {
+                ws.skip = size;
+            }
+            else {
+                for (int ix = 0; ix < (size == 126 ? 2 : 8); ++ix)
+                    ws.skip = (ws.skip << 8) | ws.frame[2 + ix];
+            }
+            ws.frameLength = 0;
+        }
+        return true;
+    }
+    // answer the upgrade request when it is all there, false if it isn't a WebSocket request
+    bool handshake(WSCLIENT& ws)
+    {
+        static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        const char* key = strstr(ws.request, "Sec-WebSocket-Key:");
+        if (!key)
+            return false;
+        key += 18;
+        while (*key == ' ')
+            ++key;
+        char text[64 + sizeof(guid)];
+        int length = 0;
+        while (length < 64 && key[length] && key[length] != '\r' && key[length] != '\n')
+            text[length] = key[length], ++length;
+        strcpy(text + length, guid);
+        uint8_t digest[20];
+        Sha1((const uint8_t*)text, strlen(text), digest);
+        char accept[32];
+        Base64(digest, sizeof(digest), accept);
+        char response[160];
+        length = snprintf(response, sizeof(response), "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+        return ws.client.write((const uint8_t*)response, length) == (size_t)length;
+    }
+public:
+    CWebSocketServer(ServerT& server) : m_server(server)
+    {
+        for (int ix = 0; ix < WEBSOCKET_CLIENTS; ++ix) {
+            m_clients[ix].bOpen = false;
+            m_clients[ix].length = 0;
+        }
+    }
+    // take new connections and finish the handshakes, call this often
+    void service(uint32_t ms)
+    {
+        ClientT client = m_server.accept();
+        if (client) {
+            int ix = 0;
+            while (ix < WEBSOCKET_CLIENTS && m_clients[ix].client)
+                ++ix;
+            if (ix == WEBSOCKET_CLIENTS) {
+                client.stop();
+            }
+            else {
+                m_clients[ix].client = client;
+                m_clients[ix].bOpen = false;
+                m_clients[ix].length = 0;
+                m_clients[ix].frameLength = 0;
+                m_clients[ix].skip = 0;
+                m_clients[ix].startMs = ms;
+            }
+        }
+        for (int ix = 0; ix < WEBSOCKET_CLIENTS; ++ix) {
+            WSCLIENT& ws = m_clients[ix];
+            if (!ws.client)
+                continue;
+            if (!ws.client.connected()) {
+                ws.client.stop();
+                continue;
+            }
+            if (ws.bOpen) {
+                // only a close matters
+                if (!readFrames(ws))
+                    ws.client.stop();
+                continue;
+            }
+            while (ws.client.available() && ws.length < WEBSOCKET_REQUEST_MAX - 1)
+                ws.request[ws.length++] = ws.client.read();
+            ws.request[ws.length] = 0;
+            if (strstr(ws.request, "\r\n\r\n")) {
+                ws.bOpen = handshake(ws);
+                if (!ws.bOpen)
+                    ws.client.stop();
+            }
+            else if (ws.length == WEBSOCKET_REQUEST_MAX - 1 || ms - ws.startMs > WEBSOCKET_HANDSHAKE_MS) {
+                ws.client.stop();
+            }
+        }
+    }
+    int clients()
+    {
+        int count = 0;
+        for (int ix = 0; ix < WEBSOCKET_CLIENTS; ++ix)
+            count += m_clients[ix].client && m_clients[ix].bOpen;
+        return count;
+    }
+    // a text frame to every open client, servers don't mask
+    void send(const char* text, int length)
+    {
+        uint8_t header[4] = { 0x81 };
+        int headerLength = 2;
+        if (length < 126) {
+            header[1] = (uint8_t)length;
+        }
+        else {
+            header[1] = 126;
+            header[2] = (uint8_t)(length >> 8);
+            header[3] = (uint8_t)length;
+            headerLength = 4;
+        }
+        for (int ix = 0; ix < WEBSOCKET_CLIENTS; ++ix) {
+            WSCLIENT& ws = m_clients[ix];
+            if (!ws.client || !ws.bOpen)
+                continue;
+            if (ws.client.write(header, headerLength) != (size_t)headerLength || ws.client.write((const uint8_t*)text, length) != (size_t)length)
+                ws.client.stop();
+        }
+    }
+};
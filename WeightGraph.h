@@ -0,0 +1,165 @@
+#pragma once
+#include <TFT_eSPI.h>
+// history of the filament weight for the graph screen
+// each display column is a time slot that keeps the lowest and highest weight seen in it, the columns
+// are a ring and the ring is drawn in place with a moving gap, so a new column only sends that one
+// column and the gap after it instead of redrawing the graph
+#define GRAPH_COLUMNS 240
+class CWeightGraph {
+private:
+    int16_t m_min[GRAPH_COLUMNS];
+    int16_t m_max[GRAPH_COLUMNS];       // less than m_min if there were no samples
+    int m_nHead = 0;                    // the column being filled
+    unsigned long m_nColumnMs = 15000;  // time for each column
+    unsigned long m_nColumnStart = 0;   // millis() when the head column started
+    bool m_bStarted = false;
+    int m_nUndrawn = 0;                 // columns finished since the last draw()
+    bool m_bHeadChanged = false;
+    // the display area
+    TFT_eSPI* m_pTft = NULL;
+    int m_nTop = 0, m_nHeight = 0;
+    uint16_t m_lineColor = TFT_GREEN;
+    uint16_t m_gapColor = TFT_DARKGREY;
+    int m_nLow = 0, m_nHigh = 0;        // weight at the bottom and top of the area
+    bool m_bValid = false;              // false means draw() sends everything
+
+    void ClearColumn(int col)
+    {
+        m_min[col] = INT16_MAX;
+        m_max[col] = INT16_MIN;
+    }
+    int WeightToY(int grams)
+    {
+        return m_nTop + m_nHeight - 1 - (long)(grams - m_nLow) * (m_nHeight - 1) / (m_nHigh - m_nLow);
+    }
+    // set the vertical scale to fit everything in the ring with a little room
+    void FitScale()
+    {
+        int low = INT16_MAX, high = INT16_MIN;
+        for (int ix = 0; ix < GRAPH_COLUMNS; ++ix) {
+            if (m_max[ix] < m_min[ix])
+                continue;
+            low = min(low, (int)m_min[ix]);
+            high = max(high, (int)m_max[ix]);
+        }
+        if (high < low) {
+            low = high = 0;
+        }
+        // don't make a few grams of noise fill the screen
+        int margin = max(5, (high - low) / 8);
+        m_nLow = max(0, low - margin);
+        m_nHigh = high + margin;
+    }
+    // one column is two narrow lines, the background and the min to max bar
+    void DrawColumn(int col)
+    {
+        m_pTft->drawFastVLine(col, m_nTop, m_nHeight, TFT_BLACK);
+        if (m_max[col] >= m_min[col]) {
+            int yTop = WeightToY(m_max[col]);
+            m_pTft->drawFastVLine(col, yTop, WeightToY(m_min[col]) - yTop + 1, m_lineColor);
+        }
+    }
+    void DrawGap()
+    {
+        m_pTft->drawFastVLine((m_nHead + 1) % GRAPH_COLUMNS, m_nTop, m_nHeight, m_gapColor);
+    }
+public:
+    // start over with a new time span for the whole graph
+    void begin(unsigned long spanMs)
+    {
+        m_nColumnMs = max(1UL, spanMs / GRAPH_COLUMNS);
+        for (int ix = 0; ix < GRAPH_COLUMNS; ++ix) {
+            ClearColumn(ix);
+        }
+        m_nHead = 0;
+        m_bStarted = false;
+        m_bValid = false;
+    }
+    // where to draw it, the width is always GRAPH_COLUMNS
+    void setArea(TFT_eSPI* pTft, int top, int height)
+    {
+        m_pTft = pTft;
+        m_nTop = top;
+        m_nHeight = height;
+        m_bValid = false;
+    }
+    // add a weight sample
+    void add(unsigned long ms, int grams)
+    {
+        if (!m_bStarted) {
+            m_nColumnStart = ms;
+            m_bStarted = true;
+        }
+        // move on to the next column when this one's time is up, skipping columns with no samples
+        int moved = 0;
+        while (ms - m_nColumnStart >= m_nColumnMs) {
+            if (++moved > GRAPH_COLUMNS) {
+                // been away longer than the whole graph
+                m_nColumnStart = ms;
+                break;
+            }
+            m_nColumnStart += m_nColumnMs;
+            m_nHead = (m_nHead + 1) % GRAPH_COLUMNS;
+            ClearColumn(m_nHead);
+            m_nUndrawn = min(m_nUndrawn + 1, GRAPH_COLUMNS);
+        }
+        if (grams < m_min[m_nHead]) {
+            m_min[m_nHead] = grams;
+            m_bHeadChanged = true;
+        }
+        if (grams > m_max[m_nHead]) {
+            m_max[m_nHead] = grams;
+            m_bHeadChanged = true;
+        }
+    }
+    // lowest and highest weights on the graph
+    int low()
+    {
+        return m_nLow;
+    }
+    int high()
+    {
+        return m_nHigh;
+    }
+    unsigned long spanMinutes()
+    {
+        return m_nColumnMs * GRAPH_COLUMNS / 60000;
+    }
+    // the next draw() sends everything
+    void invalidate()
+    {
+        m_bValid = false;
+    }
+    // send whatever changed since last time, returns true if the scale changed
+    bool draw()
+    {
+        if (m_pTft == NULL)
+            return false;
+        // a new weight off the scale means a full redraw
+        if (m_bValid && m_max[m_nHead] >= m_min[m_nHead] && (m_min[m_nHead] < m_nLow || m_max[m_nHead] > m_nHigh)) {
+            m_bValid = false;
+        }
+        bool bRescaled = !m_bValid;
+        m_pTft->startWrite();
+        if (!m_bValid) {
+            FitScale();
+            for (int ix = 0; ix < GRAPH_COLUMNS; ++ix) {
+                DrawColumn(ix);
+            }
+            DrawGap();
+        }
+        else if (m_nUndrawn || m_bHeadChanged) {
+            // the columns that finished and the head
+            for (int ix = m_nUndrawn; ix >= 0; --ix) {
+                DrawColumn((m_nHead - ix + GRAPH_COLUMNS) % GRAPH_COLUMNS);
+            }
+            if (m_nUndrawn)
+                DrawGap();
+        }
+        m_pTft->endWrite();
+        m_nUndrawn = 0;
+        m_bHeadChanged = false;
+        m_bValid = true;
+        return bRescaled;
+    }
+};
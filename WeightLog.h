@@ -0,0 +1,266 @@
+#pragma once
+#include <LittleFS.h>
+// weight history log in flash
+// samples are kept in a fixed block buffer, each block starts with a header holding a full time and
+// weight, the samples after that are varint encoded differences from the one before
+// full blocks are written to the current log file, the files are a ring so the log stays a fixed size
+// times are time(NULL) seconds, which is seconds since boot unless the clock has been set,
+// the boot number in each block tells the replay which startup the times belong to
+// a block is for one load cell, switching to another one starts a new block so the series don't get mixed
+#define LOG_DIR "/wlog"
+#define LOG_BLOCK_SIZE 256              // one flash page
+#define LOG_BLOCKS_PER_FILE 256         // 64K files
+#define LOG_MAX_FILES 16                // 1M of flash for the whole log
+#define LOG_MIN_CHANGE 10               // decigrams, smaller changes aren't logged
+#define LOG_HEARTBEAT_SECONDS 600       // log something this often even if nothing changes
+#define LOG_FLUSH_SECONDS 1800          // write a partly full block this often
+#define LOG_MAGIC 0x4C57                // "WL"
+class CWeightLog {
+public:
+    // called for each sample by replay()
+    typedef void (*ReplayFunction)(uint16_t boot, uint16_t loadCell, uint32_t time, int32_t decigrams, void* arg);
+private:
+    struct BLOCKHEADER {
+        uint16_t magic;
+        uint16_t count;                 // samples in the block including the one in the header
+        uint16_t boot;                  // startup number
+        uint16_t loadCell;              // 1 based, 0 in blocks from before there was more than one
+        uint32_t time;                  // the first sample
+        int32_t weight;
+    };
+    uint8_t m_block[LOG_BLOCK_SIZE];
+    int m_nUsed = 0;                    // bytes used in m_block, 0 if nothing in it
+    uint32_t m_nLastTime = 0;           // the last sample added
+    int32_t m_nLastWeight = 0;
+    uint32_t m_nFlushTime = 0;          // when the block was last written
+    int m_nFirstFile = 0;               // oldest file number
+    int m_nFile = 0;                    // file being written
+    int m_nBlock = 0;                   // block being filled in that file
+    uint16_t m_nBoot = 0;
+    bool m_bReady = false;
+    bool m_bDirty = false;              // the block has samples that haven't been written
+
+    BLOCKHEADER* Header()
+    {
+        return (BLOCKHEADER*)m_block;
+    }
+    static String FileName(int file)
+    {
+        char name[24];
+        sprintf(name, LOG_DIR "/%04d.bin", file);
+        return String(name);
+    }
+    static int PutVarint(uint8_t* p, uint32_t value)
+    {
+        int len = 0;
+        while (value >= 0x80) {
+            p[len++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        p[len++] = (uint8_t)value;
+        return len;
+    }
+    static uint32_t GetVarint(const uint8_t*& p, const uint8_t* end)
+    {
+        uint32_t value = 0;
+        for (int shift = 0; p < end && shift < 35; shift += 7) {
+            uint8_t b = *p++;
+            value |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        return value;
+    }
+    // signed differences are zigzag encoded so small negatives are small too
+    static uint32_t ZigZag(int32_t value)
+    {
+        return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    }
+    static int32_t UnZigZag(uint32_t value)
+    {
+        return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    }
+    void StartBlock(uint32_t time, int32_t decigrams, uint16_t loadCell)
+    {
+        memset(m_block, 0xff, sizeof(m_block));
+        Header()->magic = LOG_MAGIC;
+        Header()->count = 1;
+        Header()->boot = m_nBoot;
+        Header()->loadCell = loadCell;
+        Header()->time = time;
+        Header()->weight = decigrams;
+        m_nUsed = sizeof(BLOCKHEADER);
+    }
+    // write the block in its place in the file, a partly full block is written again when it fills
+    void WriteBlock()
+    {
+        String name = FileName(m_nFile);
+        File file = LittleFS.open(name, LittleFS.exists(name) ? "r+" : "w");
+        if (!file)
+            return;
+        file.seek(m_nBlock * LOG_BLOCK_SIZE);
+        file.write(m_block, LOG_BLOCK_SIZE);
+        file.close();
+        m_nFlushTime = m_nLastTime;
+        m_bDirty = false;
+    }
+    // write the full block and move to the next one, starting a new file and dropping the oldest when needed
+    void NextBlock()
+    {
+        WriteBlock();
+        m_nUsed = 0;
+        if (++m_nBlock >= LOG_BLOCKS_PER_FILE) {
+            m_nBlock = 0;
+            ++m_nFile;
+            while (m_nFile - m_nFirstFile >= LOG_MAX_FILES) {
+                LittleFS.remove(FileName(m_nFirstFile++));
+            }
+        }
+    }
+    // decode a block and call the function for each sample
+    static void ReplayBlock(const uint8_t* block, int used, ReplayFunction function, void* arg)
+    {
+        const BLOCKHEADER* header = (const BLOCKHEADER*)block;
+        if (header->magic != LOG_MAGIC)
+            return;
+        uint32_t time = header->time;
+        int32_t weight = header->weight;
+        uint16_t loadCell = max(header->loadCell, (uint16_t)1);
+        (*function)(header->boot, loadCell, time, weight, arg);
+        const uint8_t* p = block + sizeof(BLOCKHEADER);
+        const uint8_t* end = block + used;
+        for (int ix = 1; ix < header->count && p < end; ++ix) {
+            time += GetVarint(p, end);
+            weight += UnZigZag(GetVarint(p, end));
+            (*function)(header->boot, loadCell, time, weight, arg);
+        }
+    }
+public:
+    // mount the file system and find where the log left off
+    bool begin()
+    {
+        if (!LittleFS.begin(true))
+            return false;
+        LittleFS.mkdir(LOG_DIR);
+        File dir = LittleFS.open(LOG_DIR);
+        int first = INT_MAX, last = -1;
+        if (dir) {
+            for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+                const char* name = strrchr(file.name(), '/');
+                int number = atoi(name ? name + 1 : file.name());
+                first = min(first, number);
+                last = max(last, number);
+            }
+        }
+        m_nFirstFile = m_nFile = 0;
+        m_nBlock = 0;
+        m_nBoot = 0;
+        if (last >= 0) {
+            m_nFirstFile = first;
+            m_nFile = last;
+            File file = LittleFS.open(FileName(last), "r");
+            int blocks = file.size() / LOG_BLOCK_SIZE;
+            // the last block tells us the startup number
+            BLOCKHEADER header;
+            if (blocks && file.seek((blocks - 1) * LOG_BLOCK_SIZE) && file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.magic == LOG_MAGIC) {
+                m_nBoot = header.boot + 1;
+            }
+            file.close();
+            // a partly full block was written as a whole one, so start after it
+            m_nBlock = blocks;
+            if (m_nBlock >= LOG_BLOCKS_PER_FILE) {
+                m_nBlock = 0;
+                ++m_nFile;
+            }
+        }
+        m_nUsed = 0;
+        m_bReady = true;
+        return true;
+    }
+    // add a sample from a load cell, it is only kept if the weight changed enough or it's been a while
+    void add(uint32_t time, int32_t decigrams, uint16_t loadCell = 1)
+    {
+        if (!m_bReady)
+            return;
+        if (m_nUsed && Header()->loadCell != loadCell) {
+            // a different load cell starts its own block
+            NextBlock();
+        }
+        if (m_nUsed) {
+            if (abs(decigrams - m_nLastWeight) < LOG_MIN_CHANGE && time - m_nLastTime < LOG_HEARTBEAT_SECONDS)
+                return;
+            if (time < m_nLastTime) {
+                // the clock was set back, the differences can't be negative so start over
+                NextBlock();
+            }
+        }
+        if (m_nUsed == 0) {
+            StartBlock(time, decigrams, loadCell);
+        }
+        else {
+            uint8_t entry[10];
+            int len = PutVarint(entry, time - m_nLastTime);
+            len += PutVarint(entry + len, ZigZag(decigrams - m_nLastWeight));
+            if (m_nUsed + len > LOG_BLOCK_SIZE) {
+                NextBlock();
+                StartBlock(time, decigrams, loadCell);
+            }
+            else {
+                memcpy(m_block + m_nUsed, entry, len);
+                m_nUsed += len;
+                ++Header()->count;
+            }
+        }
+        m_nLastTime = time;
+        m_nLastWeight = decigrams;
+        m_bDirty = true;
+        if (time - m_nFlushTime >= LOG_FLUSH_SECONDS) {
+            WriteBlock();
+        }
+    }
+    // write out what is in the block now, call before a restart
+    void flush()
+    {
+        if (m_bReady && m_bDirty)
+            WriteBlock();
+    }
+    // replay one block, position starts at 0 for the oldest block and is moved along
+    // returns false when there is nothing more, this lets the caller spread a long replay out
+    bool replayNext(long& position, ReplayFunction function, void* arg = NULL)
+    {
+        if (!m_bReady)
+            return false;
+        long blocks = (long)(m_nFile - m_nFirstFile) * LOG_BLOCKS_PER_FILE + m_nBlock;
+        if (position < blocks) {
+            int fileNumber = m_nFirstFile + position / LOG_BLOCKS_PER_FILE;
+            File file = LittleFS.open(FileName(fileNumber), "r");
+            uint8_t* block = new uint8_t[LOG_BLOCK_SIZE];
+            if (file && file.seek((position % LOG_BLOCKS_PER_FILE) * LOG_BLOCK_SIZE) && file.read(block, LOG_BLOCK_SIZE) == LOG_BLOCK_SIZE) {
+                ReplayBlock(block, LOG_BLOCK_SIZE, function, arg);
+            }
+            delete[] block;
+            file.close();
+            ++position;
+            return true;
+        }
+        // the block being filled is last
+        if (position == blocks && m_nUsed) {
+            ReplayBlock(m_block, m_nUsed, function, arg);
+            ++position;
+            return true;
+        }
+        return false;
+    }
+    // call the function for every sample in the log, oldest first
+    void replay(ReplayFunction function, void* arg = NULL)
+    {
+        long position = 0;
+        while (replayNext(position, function, arg))
+            ;
+    }
+    // flash used by the log
+    uint32_t size()
+    {
+        return (uint32_t)((m_nFile - m_nFirstFile) * LOG_BLOCKS_PER_FILE + m_nBlock) * LOG_BLOCK_SIZE;
+    }
+};
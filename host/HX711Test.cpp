@@ -0,0 +1,220 @@
+// host test for the HX711 protocol in HX711.h against simulated HX711s
+// the simulated pins keep a clock in nanoseconds, halfPeriod() moves it on by what ets_delay_us(1) takes,
+// and each simulated HX711 follows the datasheet timing: DOUT changes 0.1uS after a rising edge, the
+// pulses after the 24th pick the gain for the next conversion, and SCK high for 60uS powers it down
+// build: g++ -O2 -I.. -o HX711Test HX711Test.cpp
+// usage: HX711Test, prints the checks and exits with 1 if any failed
+#include <stdio.h>
+#include <stdint.h>
+#include "HX711.h"
+
+#define SIM_HX711S 3
+#define SIM_HALF_PERIOD_NS 1000     // ets_delay_us(1)
+#define SIM_DOUT_DELAY_NS 100       // t2, DOUT is good this long after the rising edge
+#define SIM_MIN_PULSE_NS 200        // t3 and t4, the shortest SCK high and low
+#define SIM_POWER_DOWN_NS 60000     // SCK high this long powers it down
+
+// one simulated HX711
+struct SIMHX711 {
+    uint32_t value;                 // the 24 bit two's complement conversion being read out
+    int pulses;                     // since the conversion was ready
+    int gainPulses;                 // what the current conversion was made with, 1 to 3 like HX711_GAIN_A128
+    bool bReady;
+    bool bPoweredDown;
+    uint64_t doutChangeNs;          // when DOUT last changed
+    bool dout;
+};
+
+struct SimState {
+    uint64_t nowNs = 0;
+    bool sck = false;
+    uint64_t edgeNs = 0;            // the last SCK edge
+    uint64_t maxHighNs = 0;
+    uint64_t minHighNs = UINT64_MAX, minLowNs = UINT64_MAX;
+    int timingErrors = 0;           // DOUT read before it settled
+    SIMHX711 chips[SIM_HX711S];
+};
+static SimState Sim;
+
+// the simulated pins, like CHX711Pins but the "GPIO" is the simulation
+struct SimPins {
+    static const int count = SIM_HX711S;
+    static int dout(int ix)
+    {
+        return ix;
+    }
+    static void begin()
+    {
+        clockLow();
+    }
+    static void clockHigh()
+    {
+        if (Sim.sck)
+            return;
+        Sim.minLowNs = Sim.nowNs - Sim.edgeNs < Sim.minLowNs ? Sim.nowNs - Sim.edgeNs : Sim.minLowNs;
+        Sim.sck = true;
+        Sim.edgeNs = Sim.nowNs;
+        for (SIMHX711& chip : Sim.chips) {
+            if (chip.bPoweredDown || !chip.bReady)
+                continue;
+            ++chip.pulses;
+            // the MSB goes out on the first rising edge, after the 24th DOUT goes high until the next conversion
+            chip.dout = chip.pulses <= 24 ? (chip.value >> (24 - chip.pulses)) & 1 : true;
+            chip.doutChangeNs = Sim.nowNs + SIM_DOUT_DELAY_NS;
+        }
+    }
+    static void clockLow()
+    {
+        if (!Sim.sck) {
+            Sim.edgeNs = Sim.nowNs;
+            return;
+        }
+        uint64_t high = Sim.nowNs - Sim.edgeNs;
+        Sim.maxHighNs = high > Sim.maxHighNs ? high : Sim.maxHighNs;
+        Sim.minHighNs = high < Sim.minHighNs ? high : Sim.minHighNs;
+        Sim.sck = false;
+        Sim.edgeNs = Sim.nowNs;
+        if (high >= SIM_POWER_DOWN_NS) {
+            // it was powered down, coming back it starts again on channel A at 128
+            for (SIMHX711& chip : Sim.chips) {
+                chip.bPoweredDown = false;
+                chip.gainPulses = HX711_GAIN_A128;
+                chip.pulses = 0;
+            }
+        }
+    }
+    static void halfPeriod()
+    {
+        Sim.nowNs += SIM_HALF_PERIOD_NS;
+    }
+    static uint32_t inputs()
+    {
+        uint32_t in = 0;
+        for (int ix = 0; ix < count; ++ix) {
+            const SIMHX711& chip = Sim.chips[ix];
+            if (chip.bReady && Sim.nowNs < chip.doutChangeNs)
+                ++Sim.timingErrors;
+            in |= (uint32_t)(chip.bReady ? chip.dout : 1) << ix;
+        }
+        return in;
+    }
+    static bool ready()
+    {
+        return (inputs() & ((1 << count) - 1)) == 0;
+    }
+    static void shiftIn(int gainPulses, uint32_t* values)
+    {
+        CHX711BitBang<SimPins>::shiftIn(gainPulses, values);
+    }
+    static void powerDown()
+    {
+        clockLow();
+        clockHigh();
+    }
+    static void powerUp()
+    {
+        clockLow();
+    }
+};
+
+static int Failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+    printf("%s: %s\n", ok ? "pass" : "FAIL", what);
+    if (!ok)
+        ++Failures;
+}
+
+// a new conversion in each HX711, the pulses after the last read set the gain it was made with
+static void Convert(const uint32_t* values)
+{
+    for (int ix = 0; ix < SIM_HX711S; ++ix) {
+        SIMHX711& chip = Sim.chips[ix];
+        if (chip.bReady)
+            chip.gainPulses = chip.pulses - 24;
+        chip.value = values[ix] & 0xffffff;
+        chip.pulses = 0;
+        chip.bReady = true;
+        chip.dout = false;
+        chip.doutChangeNs = Sim.nowNs;
+    }
+    // the next conversion is a while away at 80 SPS
+    Sim.nowNs += 1000000;
+}
+
+int main()
+{
+    CHX711<SimPins> hx711;
+    hx711.begin(HX711_GAIN_A128);
+    Check(!hx711.ready(), "not ready before a conversion");
+    // the data bits, the ends of the range and a spread of values, read back as offset binary
+    uint32_t seed = 12345;
+    bool bValuesOk = true;
+    bool bPulsesOk = true;
+    for (int round = 0; round < 1000; ++round) {
+        uint32_t values[SIM_HX711S];
+        for (int ix = 0; ix < SIM_HX711S; ++ix) {
+            seed = seed * 1103515245 + 12345;
+            values[ix] = round == 0 ? 0x000000 : round == 1 ? 0x7fffff : round == 2 ? 0x800000 : round == 3 ? 0xffffff : seed >> 8;
+        }
+        Convert(values);
+        if (!hx711.ready()) {
+            bValuesOk = false;
+            break;
+        }
+        uint32_t read[SIM_HX711S];
+        hx711.read(read);
+        for (int ix = 0; ix < SIM_HX711S; ++ix) {
+            bValuesOk = bValuesOk && read[ix] == ((values[ix] & 0xffffff) ^ 0x800000);
+            bPulsesOk = bPulsesOk && Sim.chips[ix].pulses == 24 + HX711_GAIN_A128;
+        }
+        Sim.nowNs += 1000000;
+    }
+    Check(bValuesOk, "24 data bits from each HX711, as offset binary");
+    Check(bPulsesOk, "25 pulses a read at 128");
+    Check(!hx711.ready(), "not ready after the read until the next conversion");
+    // the gain is sent with a read and used for the conversion after it
+    const struct { int gain; int pulses; const char* name; } gains[] = {
+        { HX711_GAIN_B32, 26, "B 32" },
+        { HX711_GAIN_A64, 27, "A 64" },
+        { HX711_GAIN_A128, 25, "A 128" },
+    };
+    for (const auto& gain : gains) {
+        uint32_t values[SIM_HX711S] = { 1, 2, 3 }, read[SIM_HX711S];
+        hx711.setGain(gain.gain);
+        Convert(values);
+        hx711.read(read);
+        bool bOk = true;
+        for (int ix = 0; ix < SIM_HX711S; ++ix)
+            bOk = bOk && Sim.chips[ix].pulses == gain.pulses;
+        Convert(values);
+        for (int ix = 0; ix < SIM_HX711S; ++ix)
+            bOk = bOk && Sim.chips[ix].gainPulses == gain.gain;
+        char what[64];
+        snprintf(what, sizeof(what), "%d pulses for %s and the next conversion uses it", gain.pulses, gain.name);
+        Check(bOk, what);
+        hx711.read(read);
+    }
+    // the timing of every pulse so far
+    char what[80];
+    snprintf(what, sizeof(what), "SCK high at most %.1fuS, under 60uS", Sim.maxHighNs / 1000.0);
+    Check(Sim.maxHighNs < SIM_POWER_DOWN_NS, what);
+    snprintf(what, sizeof(what), "SCK high at least %.1fuS and low at least %.1fuS, 0.2uS is the minimum", Sim.minHighNs / 1000.0, Sim.minLowNs / 1000.0);
+    Check(Sim.minHighNs >= SIM_MIN_PULSE_NS && Sim.minLowNs >= SIM_MIN_PULSE_NS, what);
+    Check(Sim.timingErrors == 0, "DOUT is only read after it has settled");
+    // holding SCK high powers it down, and it comes back at 128
+    hx711.setGain(HX711_GAIN_A64);
+    uint32_t values[SIM_HX711S] = { 4, 5, 6 }, read[SIM_HX711S];
+    Convert(values);
+    hx711.read(read);
+    hx711.powerDown();
+    Sim.nowNs += 100000;
+    hx711.powerUp();
+    bool bReset = true;
+    for (int ix = 0; ix < SIM_HX711S; ++ix)
+        bReset = bReset && Sim.chips[ix].gainPulses == HX711_GAIN_A128;
+    Check(Sim.maxHighNs >= SIM_POWER_DOWN_NS && bReset, "power down holds SCK high and it comes back at 128");
+    printf("%s\n", Failures ? "FAILED" : "all passed");
+    return Failures ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+// host side decoder for the scale's binary stream, see ScaleStream.h
+// subscribes to the stream on a serial port and prints the frames as CSV lines
+// build: g++ -O2 -I.. -o StreamDump StreamDump.cpp
+// usage: StreamDump /dev/ttyUSB0 [samples|state|all]
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include "ScaleStream.h"
+
+static void PrintFrame(CStreamDecoder& decoder)
+{
+    const uint8_t* p = decoder.payload();
+    int length = decoder.payloadLength();
+    switch (decoder.type()) {
+    case STREAM_HELLO:
+        if (length < 13)
+            break;
+        printf("hello,%u,%g,%ld,%g\n", p[0], CStreamDecoder::GetFloat(p + 1), (long)(int32_t)CStreamDecoder::Get32(p + 5), CStreamDecoder::GetFloat(p + 9));
+        break;
+    case STREAM_SAMPLES:
+        for (int ix = 0; ix < p[0] && 1 + (ix + 1) * STREAM_SAMPLE_SIZE <= length; ++ix) {
+            const uint8_t* sample = p + 1 + ix * STREAM_SAMPLE_SIZE;
+            printf("sample,%lu,%ld,%.2f\n", (unsigned long)CStreamDecoder::Get32(sample), (long)(int32_t)CStreamDecoder::Get32(sample + 4), CStreamDecoder::GetFloat(sample + 8));
+        }
+        break;
+    case STREAM_STATE:
+        if (length < 25)
+            break;
+        printf("state,%lu,%.2f,%ld,%u,%.2f,%.2f,%ld\n", (unsigned long)CStreamDecoder::Get32(p), CStreamDecoder::GetFloat(p + 4),
+            (long)(int32_t)CStreamDecoder::Get32(p + 8), p[12], CStreamDecoder::GetFloat(p + 13), CStreamDecoder::GetFloat(p + 17),
+            (long)(int32_t)CStreamDecoder::Get32(p + 21));
+        break;
+    case STREAM_EVENT:
+        if (length < 11)
+            break;
+        printf("event,%lu,%u,%u,%u,%.2f\n", (unsigned long)CStreamDecoder::Get32(p), p[4], p[5], p[6], CStreamDecoder::GetFloat(p + 7));
+        break;
+    default:
+        fprintf(stderr, "unknown frame type %u\n", decoder.type());
+        break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s port [samples|state|all]\n", argv[0]);
+        return 1;
+    }
+    int fd = open(argv[1], O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B115200);
+    cfsetospeed(&tio, B115200);
+    tcsetattr(fd, TCSANOW, &tio);
+    char command[64];
+    snprintf(command, sizeof(command), "subscribe %s\n", argc > 2 ? argv[2] : "all");
+    if (write(fd, command, strlen(command)) < 0) {
+        perror("write");
+        return 1;
+    }
+    CStreamDecoder decoder;
+    uint8_t buffer[256];
+    for (;;) {
+        int count = read(fd, buffer, sizeof(buffer));
+        if (count <= 0)
+            break;
+        for (int ix = 0; ix < count; ++ix) {
+            if (decoder.feed(buffer[ix]))
+                PrintFrame(decoder);
+        }
+        fflush(stdout);
+    }
+    fprintf(stderr, "%lu frames, %lu bad, %lu lost\n", decoder.frames, decoder.badFrames, decoder.lostFrames);
+    return 0;
+}
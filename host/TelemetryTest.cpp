@@ -0,0 +1,363 @@
+// host test for Telemetry.h, the message timing and batching, and the MQTT and WebSocket bytes on the wire
+// the MQTT client and the WebSocket server run on loopback sockets, the test is the broker and the browser
+// on the other end and checks what they send against MQTT 3.1.1 and the RFC 6455 example handshake
+// build: g++ -O2 -I.. -o TelemetryTest TelemetryTest.cpp
+// usage: TelemetryTest, prints the checks and exits with 1 if any failed
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "Telemetry.h"
+
+// a nonblocking socket with the WiFiClient calls that Telemetry.h uses
+struct HostClient {
+    int fd = -1;
+    size_t write(const uint8_t* data, size_t length)
+    {
+        return send(fd, data, length, MSG_NOSIGNAL) == (ssize_t)length ? length : 0;
+    }
+    int available()
+    {
+        uint8_t peek[1024];
+        int count = recv(fd, peek, sizeof(peek), MSG_PEEK);
+        return count > 0 ? count : 0;
+    }
+    int read()
+    {
+        uint8_t value;
+        return recv(fd, &value, 1, 0) == 1 ? value : -1;
+    }
+    int read(uint8_t* data, size_t length)
+    {
+        return recv(fd, data, length, 0);
+    }
+    bool connected()
+    {
+        if (fd < 0)
+            return false;
+        uint8_t peek;
+        int count = recv(fd, &peek, 1, MSG_PEEK);
+        return count > 0 || (count < 0 && errno == EAGAIN);
+    }
+    void stop()
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+    explicit operator bool() const
+    {
+        return fd >= 0;
+    }
+};
+
+// a listening socket on a free loopback port, like WiFiServer
+struct HostServer {
+    int fd;
+    int port;
+    HostServer()
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, (sockaddr*)&address, sizeof(address));
+        listen(fd, 4);
+        socklen_t length = sizeof(address);
+        getsockname(fd, (sockaddr*)&address, &length);
+        port = ntohs(address.sin_port);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+    ~HostServer()
+    {
+        close(fd);
+    }
+    HostClient accept()
+    {
+        HostClient client;
+        client.fd = ::accept(fd, NULL, NULL);
+        if (client.fd >= 0)
+            fcntl(client.fd, F_SETFL, O_NONBLOCK);
+        return client;
+    }
+};
+
+// the test's end of a connection, it blocks, and small writes go at once so a frame can be sent a byte at a time
+static int Connect(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&address, sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// what the other end sent in the next waitMs, up to size bytes
+static int Receive(int fd, uint8_t* data, int size, int waitMs = 200)
+{
+    int count = 0;
+    pollfd p = { fd, POLLIN, 0 };
+    while (count < size && poll(&p, 1, waitMs) > 0) {
+        int got = recv(fd, data + count, size - count, 0);
+        if (got <= 0)
+            break;
+        count += got;
+    }
+    return count;
+}
+
+static bool Same(const uint8_t* data, int length, const uint8_t* expected, int expectedLength)
+{
+    return length == expectedLength && memcmp(data, expected, length) == 0;
+}
+
+static int Failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+    printf("%s: %s\n", ok ? "pass" : "FAIL", what);
+    if (!ok)
+        ++Failures;
+}
+
+static void TestChannel()
+{
+    CTelemetryChannel channel;
+    channel.begin(1);
+    char text[TELEMETRY_MAX_PAYLOAD];
+    TELEMETRYSTATE state = { 1000.0f, 800, 80, 300.0f, 0, -1, false, 0 };
+    Check(channel.stateDue(state, 0), "the first state is sent at once");
+    channel.formatState(state, 0, text, sizeof(text));
+    Check(strcmp(text, "{\"c\":1,\"k\":\"state\",\"w\":1000.0,\"f\":800,\"p\":80,\"m\":300.0,\"r\":0.00,\"l\":-1,\"s\":0,\"a\":0}") == 0, "state message");
+    Check(!channel.stateDue(state, 5000), "the same state isn't sent again");
+    state.weight = 1000.3f;
+    Check(!channel.stateDue(state, 5000), "a change inside the deadband isn't sent");
+    state.weight = 999.0f;
+    Check(!channel.stateDue(state, TELEMETRY_MOVING_MS - 1) && channel.stateDue(state, TELEMETRY_MOVING_MS), "while moving a change goes once a second");
+    channel.formatState(state, 1000, text, sizeof(text));
+    state.bStable = true;
+    Check(channel.stateDue(state, 1001), "a stability change goes at once");
+    channel.formatState(state, 1001, text, sizeof(text));
+    state.weight = 998.0f;
+    Check(!channel.stateDue(state, 1001 + TELEMETRY_STABLE_MS - 1) && channel.stateDue(state, 1001 + TELEMETRY_STABLE_MS), "while stable a change goes every 30 seconds");
+    state.alarms = TELEMETRY_ALARM_RUNOUT;
+    Check(channel.stateDue(state, 1002), "an alarm change goes at once");
+    channel.formatState(state, 1002, text, sizeof(text));
+    Check(!channel.stateDue(state, 1002 + TELEMETRY_HEARTBEAT_MS - 1) && channel.stateDue(state, 1002 + TELEMETRY_HEARTBEAT_MS), "the heartbeat goes every minute");
+    channel.resend();
+    Check(channel.stateDue(state, 1003), "resend sends the state at once");
+    // the samples wait for a full batch or the oldest one to get old
+    bool bFull = false;
+    for (int ix = 0; ix < 3; ++ix)
+        bFull = channel.addSample(500.0f - ix * 0.5f, 2000 + ix * 100);
+    Check(!bFull && !channel.samplesDue(2000 + TELEMETRY_BATCH_MS - 1) && channel.samplesDue(2000 + TELEMETRY_BATCH_MS), "samples go when the oldest has waited a second");
+    channel.formatSamples(text, sizeof(text));
+    Check(strcmp(text, "{\"c\":1,\"k\":\"samples\",\"t\":2000,\"dt\":100,\"d\":[5000,4995,4990]}") == 0, "samples message in decigrams");
+    Check(channel.samples() == 0 && !channel.samplesDue(10000), "formatting the samples empties the batch");
+    int full = 0;
+    for (int ix = 0; ix < TELEMETRY_MAX_SAMPLES; ++ix)
+        full += channel.addSample(-12345.6f, 20000 + ix * 12) ? ix + 1 : 0;
+    Check(full == TELEMETRY_MAX_SAMPLES, "the batch is full at TELEMETRY_MAX_SAMPLES");
+    int length = channel.formatSamples(text, sizeof(text));
+    Check(length == (int)strlen(text) && length < (int)sizeof(text) && strcmp(text + length - 2, "]}") == 0, "a full batch of the longest samples fits in a message");
+}
+
+static void TestMqtt()
+{
+    HostServer broker;
+    HostClient client;
+    client.fd = Connect(broker.port);
+    fcntl(client.fd, F_SETFL, O_NONBLOCK);
+    int peer = -1;
+    for (int tries = 0; tries < 100 && peer < 0; ++tries, usleep(1000))
+        peer = ::accept(broker.fd, NULL, NULL);
+    CMqttClient<HostClient> mqtt(client);
+    uint8_t data[512];
+    mqtt.begin("scale-1", 0);
+    const uint8_t connect[] = { 0x10, 0x13, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3c, 0x00, 0x07, 's', 'c', 'a', 'l', 'e', '-', '1' };
+    Check(Same(data, Receive(peer, data, sizeof(data)), connect, sizeof(connect)), "CONNECT, MQTT 3.1.1 with a clean session and a 60 second keepalive");
+    Check(mqtt.state() == CMqttClient<HostClient>::CONNECTING && !mqtt.publish("a/b", "hi", 2, false, 0), "nothing is published before the CONNACK");
+    const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    send(peer, connack, sizeof(connack), 0);
+    usleep(10000);
+    mqtt.service(10);
+    Check(mqtt.connected(), "connected after the CONNACK");
+    mqtt.publish("a/b", "hi", 2, true, 20);
+    const uint8_t publish[] = { 0x31, 0x07, 0x00, 0x03, 'a', '/', 'b', 'h', 'i' };
+    Check(Same(data, Receive(peer, data, sizeof(data)), publish, sizeof(publish)), "PUBLISH at QoS 0 with retain");
+    char payload[300];
+    memset(payload, 'x', sizeof(payload));
+    mqtt.publish("t", payload, sizeof(payload), false, 30);
+    int length = Receive(peer, data, sizeof(data));
+    const uint8_t header[] = { 0x30, 0xaf, 0x02, 0x00, 0x01, 't' };
+    Check(length == (int)sizeof(header) + 300 && memcmp(data, header, sizeof(header)) == 0, "a remaining length over 127 takes two bytes");
+    // the broker's PINGRESP is read and thrown away, the ping goes half way through the keepalive
+    const uint8_t pingresp[] = { 0xd0, 0x00 };
+    send(peer, pingresp, sizeof(pingresp), 0);
+    usleep(10000);
+    mqtt.service(30 + MQTT_KEEPALIVE_SECONDS * 500 - 1);
+    Check(Receive(peer, data, sizeof(data), 50) == 0 && mqtt.connected(), "no PINGREQ before half the keepalive");
+    mqtt.service(30 + MQTT_KEEPALIVE_SECONDS * 500);
+    const uint8_t pingreq[] = { 0xc0, 0x00 };
+    Check(Same(data, Receive(peer, data, sizeof(data)), pingreq, sizeof(pingreq)), "PINGREQ after half the keepalive");
+    mqtt.stop();
+    const uint8_t disconnect[] = { 0xe0, 0x00 };
+    Check(Same(data, Receive(peer, data, sizeof(data)), disconnect, sizeof(disconnect)) && mqtt.state() == CMqttClient<HostClient>::DISCONNECTED, "DISCONNECT when it stops");
+    close(peer);
+    // a broker that refuses the connection, and one that never answers
+    client.fd = Connect(broker.port);
+    fcntl(client.fd, F_SETFL, O_NONBLOCK);
+    peer = ::accept(broker.fd, NULL, NULL);
+    mqtt.begin("scale-1", 0);
+    Receive(peer, data, sizeof(data));
+    const uint8_t refused[] = { 0x20, 0x02, 0x00, 0x05 };
+    send(peer, refused, sizeof(refused), 0);
+    usleep(10000);
+    mqtt.service(10);
+    Check(mqtt.state() == CMqttClient<HostClient>::DISCONNECTED, "a refused CONNACK disconnects");
+    close(peer);
+    client.fd = Connect(broker.port);
+    fcntl(client.fd, F_SETFL, O_NONBLOCK);
+    peer = ::accept(broker.fd, NULL, NULL);
+    mqtt.begin("scale-1", 0);
+    mqtt.service(MQTT_CONNACK_MS);
+    bool bWaiting = mqtt.state() == CMqttClient<HostClient>::CONNECTING;
+    mqtt.service(MQTT_CONNACK_MS + 1);
+    Check(bWaiting && mqtt.state() == CMqttClient<HostClient>::DISCONNECTED, "no CONNACK in time disconnects");
+    close(peer);
+}
+
+// a masked frame from the browser, clients always mask
+// the mask starts like a close frame, so a server that takes it for the next header drops the client
+static int MaskedFrame(uint8_t opcode, const uint8_t* payload, int length, uint8_t* out)
+{
+    const uint8_t mask[4] = { 0x88, 0x80, 0x5a, 0xa5 };
+    int count = 0;
+    out[count++] = 0x80 | opcode;
+    if (length < 126) {
+        out[count++] = 0x80 | length;
+    }
+    else if (length < 65536) {
+        out[count++] = 0x80 | 126;
+        out[count++] = (uint8_t)(length >> 8);
+        out[count++] = (uint8_t)length;
+    }
+    else {
+        out[count++] = 0x80 | 127;
+        for (int ix = 7; ix >= 0; --ix)
+            out[count++] = (uint8_t)((uint64_t)length >> (ix * 8));
+    }
+    memcpy(out + count, mask, 4);
+    count += 4;
+    for (int ix = 0; ix < length; ++ix)
+        out[count++] = payload[ix] ^ mask[ix % 4];
+    return count;
+}
+
+// send it a piece at a time with the server serviced in between, so the headers arrive split up,
+// then give the server time to read what is still in the socket
+static void SendPieces(int fd, const uint8_t* data, int length, int piece, CWebSocketServer<HostServer, HostClient>& server)
+{
+    for (int ix = 0; ix < length; ix += piece) {
+        send(fd, data + ix, length - ix < piece ? length - ix : piece, 0);
+        usleep(1000);
+        server.service(0);
+    }
+    for (int ix = 0; ix < 20; ++ix) {
+        usleep(1000);
+        server.service(0);
+    }
+}
+
+static void TestWebSocket()
+{
+    HostServer listener;
+    CWebSocketServer<HostServer, HostClient> server(listener);
+    int browser = Connect(listener.port);
+    uint8_t data[80000];
+    // the example from RFC 6455 section 1.3, sent in two pieces
+    const char* request = "GET /telemetry HTTP/1.1\r\nHost: scale\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    send(browser, request, 40, 0);
+    usleep(10000);
+    server.service(0);
+    Check(server.clients() == 0 && Receive(browser, data, sizeof(data), 50) == 0, "no answer until the request is all there");
+    send(browser, request + 40, strlen(request) - 40, 0);
+    usleep(10000);
+    server.service(0);
+    int length = Receive(browser, data, sizeof(data) - 1);
+    data[length] = 0;
+    Check(strncmp((char*)data, "HTTP/1.1 101 Switching Protocols\r\n", 34) == 0 && strstr((char*)data, "\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n")
+        && strcmp((char*)data + length - 4, "\r\n\r\n") == 0, "handshake answers the RFC 6455 example key");
+    Check(server.clients() == 1, "the client is open after the handshake");
+    // unmasked text frames, the length goes to 16 bits at 126
+    server.send("hello", 5);
+    const uint8_t hello[] = { 0x81, 0x05, 'h', 'e', 'l', 'l', 'o' };
+    Check(Same(data, Receive(browser, data, sizeof(data)), hello, sizeof(hello)), "a short text frame");
+    char text[300];
+    memset(text, 'y', sizeof(text));
+    server.send(text, sizeof(text));
+    length = Receive(browser, data, sizeof(data));
+    const uint8_t header[] = { 0x81, 0x7e, 0x01, 0x2c };
+    Check(length == (int)sizeof(header) + 300 && memcmp(data, header, sizeof(header)) == 0, "a 300 byte text frame has a 16 bit length");
+    // what the browser sends is thrown away, with the headers split across reads
+    uint8_t frames[80000], payload[70000];
+    memset(payload, 'z', sizeof(payload));
+    int count = MaskedFrame(0x1, payload, 2, frames);
+    count += MaskedFrame(0x9, payload, 0, frames + count);
+    count += MaskedFrame(0x2, payload, 300, frames + count);
+    SendPieces(browser, frames, count, 3, server);
+    count = MaskedFrame(0x2, payload, sizeof(payload), frames);
+    SendPieces(browser, frames, count, 4096, server);
+    Check(server.clients() == 1, "frames from the browser with 7, 16 and 64 bit lengths are skipped");
+    server.send("hi", 2);
+    const uint8_t hi[] = { 0x81, 0x02, 'h', 'i' };
+    Check(Same(data, Receive(browser, data, sizeof(data)), hi, sizeof(hi)), "still sending after the browser's frames");
+    // a close drops it
+    count = MaskedFrame(0x8, payload, 0, frames);
+    SendPieces(browser, frames, count, 1, server);
+    Check(server.clients() == 0, "a close from the browser drops the client");
+    close(browser);
+    // a request that isn't a WebSocket upgrade is dropped, and only WEBSOCKET_CLIENTS are taken
+    browser = Connect(listener.port);
+    const char* plain = "GET / HTTP/1.1\r\nHost: scale\r\n\r\n";
+    send(browser, plain, strlen(plain), 0);
+    usleep(10000);
+    server.service(0);
+    Check(Receive(browser, data, sizeof(data), 100) == 0 && server.clients() == 0, "a request without a key is dropped");
+    close(browser);
+    int browsers[WEBSOCKET_CLIENTS + 1];
+    for (int ix = 0; ix <= WEBSOCKET_CLIENTS; ++ix) {
+        browsers[ix] = Connect(listener.port);
+        send(browsers[ix], request, strlen(request), 0);
+        usleep(10000);
+        server.service(0);
+    }
+    server.service(0);
+    Check(server.clients() == WEBSOCKET_CLIENTS && Receive(browsers[WEBSOCKET_CLIENTS], data, sizeof(data), 100) == 0, "only WEBSOCKET_CLIENTS are taken");
+    for (int ix = 0; ix <= WEBSOCKET_CLIENTS; ++ix)
+        close(browsers[ix]);
+}
+
+int main()
+{
+    TestChannel();
+    TestMqtt();
+    TestWebSocket();
+    printf("%s\n", Failures ? "FAILED" : "all passed");
+    return Failures ? 1 : 0;
+}